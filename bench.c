@@ -0,0 +1,795 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ldasm.h"
+#include "ldasm_elf.h"
+#include "ldasm_cache.h"
+#include "rle.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define HAVE_TSC 1
+#endif
+
+// Decoder throughput benchmark.
+//
+// usage: bench [--iterations N] [--reps N] [--threads N] [file ...]
+//
+// Every workload is decoded by every sweep method. The executable sections of the given ELF
+// files (the benchmark binary itself by default) are used as real code. Synthetic workloads
+// are generated from a fixed seed. Each measurement is the best of --reps repetitions of
+// --iterations runs, so results are comparable from run to run. ldasm_sweep_parallel() is run
+// with 1, 2, 4... up to --threads threads (default 8).
+//
+// The last real code workload is also replayed from 1 to 64 threads at once, through plain
+// ldasm(), a mutex around ldasm_cache and the lock-free ldasm_shared_cache, and blobs derived
+// from it (instruction lengths, packed instructions, a run-heavy index) go through the RLE codec.
+
+#define SYNTHETIC_COUNT 5
+#define SYNTHETIC_SIZE  (4u << 20)
+#define BATCH           4096
+#define HOT_BYTES       (64u << 10)
+#define HOT_PASSES      16
+#define RLE_BLOB_SIZE   (16u << 20)
+#define RLE_CHUNK       4096
+
+typedef struct _workload
+{
+	char     name[64];
+	uint8_t* code;
+	size_t   len;
+	bool     is64;
+} workload;
+
+typedef struct _bench_config
+{
+	int      iterations;
+	int      reps;
+	unsigned threads;
+} bench_config;
+
+static ldasm_insn out[BATCH];
+static uint8_t lengths[BATCH];
+static uint8_t flags[BATCH];
+static uint32_t packed[BATCH];
+static uint8_t* all_lengths;
+static ldasm_cache cache;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t now_ticks(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* xorshift, fixed seed so every run decodes the same bytes */
+static uint32_t rng_state = 0x2545F491u;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/* template byte replaced by a random one, so real 0xFF opcodes stay as they are */
+#define RND (-1)
+
+/* fill a buffer by repeating instruction templates */
+static void fill(uint8_t* code, size_t len, const int16_t (*templates)[16], const uint8_t* sizes, size_t count)
+{
+	size_t pos = 0;
+
+	while (pos < len) {
+		size_t t = rng() % count;
+		for (size_t i = 0; i < sizes[t] && pos < len; i++) {
+			int16_t b = templates[t][i];
+			code[pos++] = b == RND ? (uint8_t)rng() : (uint8_t)b;
+		}
+	}
+}
+
+static bool add_synthetic(workload* w, const char* name, const int16_t (*templates)[16], const uint8_t* sizes, size_t count)
+{
+	w->code = malloc(SYNTHETIC_SIZE);
+	if (!w->code)
+		return false;
+
+	snprintf(w->name, sizeof(w->name), "%s", name);
+	w->len = SYNTHETIC_SIZE;
+	w->is64 = true;
+	fill(w->code, w->len, templates, sizes, count);
+	return true;
+}
+
+static size_t make_synthetic(workload* w)
+{
+	static const int16_t prefix[][16] = {
+		{ 0x66, 0x89, 0xC8 },                               /* mov ax, cx */
+		{ 0xF3, 0x48, 0xA5 },                               /* rep movsq */
+		{ 0x2E, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0, 0, 0, 0 }, /* cs nop word [rax+rax] */
+		{ 0xF0, 0x48, 0x0F, 0xB1, 0x0A },                   /* lock cmpxchg [rdx], rcx */
+		{ 0x64, 0x48, 0x8B, 0x04, 0x25, 0x28, 0, 0, 0 },    /* mov rax, fs:[0x28] */
+	};
+	static const uint8_t prefix_sizes[] = { 3, 3, 10, 5, 9 };
+
+	static const int16_t sse[][16] = {
+		{ 0x66, 0x0F, 0x38, 0x00, 0xC1 },                   /* pshufb xmm0, xmm1 */
+		{ 0x66, 0x0F, 0x3A, 0x0F, 0xC1, 0x08 },             /* palignr xmm0, xmm1, 8 */
+		{ 0x66, 0x0F, 0x38, 0x17, 0x44, 0x24, 0x10 },       /* ptest xmm0, [rsp+0x10] */
+		{ 0x66, 0x0F, 0x3A, 0x22, 0xC0, 0x01 },             /* pinsrd xmm0, eax, 1 */
+		{ 0x0F, 0x28, 0xC1 },                               /* movaps xmm0, xmm1 */
+	};
+	static const uint8_t sse_sizes[] = { 5, 6, 7, 6, 3 };
+
+	static const int16_t modrm[][16] = {
+		{ 0x8B, 0x84, 0x24, RND, RND, 0, 0 },               /* mov eax, [rsp+disp32] */
+		{ 0x48, 0x89, 0x84, 0xC8, RND, RND, 0, 0 },         /* mov [rax+rcx*8+disp32], rax */
+		{ 0x48, 0x8D, 0x05, RND, RND, RND, 0 },             /* lea rax, [rip+disp32] */
+		{ 0x8B, 0x04, 0x25, RND, RND, 0, 0 },               /* mov eax, [disp32] */
+		{ 0x4C, 0x8B, 0x44, 0x24, RND },                    /* mov r8, [rsp+disp8] */
+	};
+	static const uint8_t modrm_sizes[] = { 7, 8, 7, 7, 5 };
+
+	static const int16_t imm64[][16] = {
+		{ 0x48, 0xB8, RND, RND, RND, RND, RND, RND, RND, RND },         /* mov rax, imm64 */
+		{ 0x49, 0xBB, RND, RND, RND, RND, RND, RND, RND, RND },         /* mov r11, imm64 */
+		{ 0x41, 0xFF, 0xE3 },                                           /* jmp r11 */
+	};
+	static const uint8_t imm64_sizes[] = { 10, 10, 3 };
+
+	static const int16_t avx[][16] = {
+		{ 0xC5, 0xFC, 0x28, 0xC1 },                         /* vmovaps ymm0, ymm1 */
+		{ 0xC4, 0xE2, 0x7D, 0x18, 0x44, 0x24, 0x10 },       /* vbroadcastss ymm0, [rsp+0x10] */
+		{ 0xC4, 0xE3, 0x7D, 0x0F, 0xC1, 0x04 },             /* vpalignr ymm0, ymm0, ymm1, 4 */
+		{ 0x62, 0xF1, 0x7C, 0x48, 0x10, 0x40, 0x01 },       /* vmovups zmm0, [rax+0x40] */
+		{ 0x62, 0xF3, 0x7D, 0x48, 0x25, 0xC1, RND },        /* vpternlogd zmm0, zmm0, zmm1, imm8 */
+	};
+	static const uint8_t avx_sizes[] = { 4, 7, 6, 7, 7 };
+
+	size_t n = 0;
+	n += add_synthetic(&w[n], "synthetic prefixes", prefix, prefix_sizes, 5);
+	n += add_synthetic(&w[n], "synthetic 0F38/0F3A", sse, sse_sizes, 5);
+	n += add_synthetic(&w[n], "synthetic modrm+sib+disp32", modrm, modrm_sizes, 5);
+	n += add_synthetic(&w[n], "synthetic mov imm64", imm64, imm64_sizes, 3);
+	n += add_synthetic(&w[n], "synthetic VEX/EVEX", avx, avx_sizes, 5);
+	return n;
+}
+
+/* concatenated executable sections of an ELF file */
+static bool make_text(workload* w, const char* path)
+{
+	ldasm_elf_index index;
+	if (!ldasm_elf_index_open(&index, path, NULL))
+		return false;
+
+	size_t len = 0;
+	for (size_t i = 0; i < index.section_count; i++)
+		len += (size_t)index.sections[i].size;
+
+	w->code = len ? malloc(len) : NULL;
+	if (w->code) {
+		w->len = 0;
+		for (size_t i = 0; i < index.section_count; i++) {
+			memcpy(w->code + w->len, index.image + index.sections[i].offset, (size_t)index.sections[i].size);
+			w->len += (size_t)index.sections[i].size;
+		}
+
+		const char* base = strrchr(path, '/');
+		snprintf(w->name, sizeof(w->name), ".text %s", base ? base + 1 : path);
+		w->is64 = index.is64;
+	} //if
+
+	ldasm_elf_index_close(&index);
+	return w->code != NULL;
+}
+
+static size_t run_ldasm(const workload* w, const bench_config* cfg)
+{
+	ldasm_insn ld;
+	size_t pos = 0, count = 0;
+	(void)cfg;
+
+	while (pos < w->len) {
+		size_t n = ldasm_ex(w->code + pos, w->len - pos, NULL, &ld, w->is64);
+		if (n == LDASM_TRUNCATED)
+			break;
+		pos += n;
+		++count;
+	}
+
+	return count;
+}
+
+static size_t run_sweep(const workload* w, const bench_config* cfg)
+{
+	size_t pos = 0, count = 0, consumed;
+	(void)cfg;
+
+	while (pos < w->len) {
+		size_t n = ldasm_sweep(w->code + pos, w->len - pos, NULL, w->is64, out, lengths, BATCH, &consumed);
+		pos += consumed;
+		count += n;
+		if (n < BATCH)
+			break;
+	}
+
+	return count;
+}
+
+static size_t run_sweep_lengths(const workload* w, const bench_config* cfg)
+{
+	size_t pos = 0, count = 0, consumed;
+	(void)cfg;
+
+	while (pos < w->len) {
+		size_t n = ldasm_sweep_lengths(w->code + pos, w->len - pos, NULL, w->is64, lengths, BATCH, &consumed);
+		pos += consumed;
+		count += n;
+		if (n < BATCH)
+			break;
+	}
+
+	return count;
+}
+
+/* the fields most consumers want: lengths and flags */
+static size_t run_sweep_soa(const workload* w, const bench_config* cfg)
+{
+	const ldasm_soa soa = { .length = lengths, .flags = flags };
+	size_t pos = 0, count = 0, consumed;
+	(void)cfg;
+
+	while (pos < w->len) {
+		size_t n = ldasm_sweep_soa(w->code + pos, w->len - pos, NULL, w->is64, &soa, BATCH, &consumed);
+		pos += consumed;
+		count += n;
+		if (n < BATCH)
+			break;
+	}
+
+	return count;
+}
+
+static size_t run_sweep_packed(const workload* w, const bench_config* cfg)
+{
+	size_t pos = 0, count = 0, consumed;
+	(void)cfg;
+
+	while (pos < w->len) {
+		size_t n = ldasm_sweep_packed(w->code + pos, w->len - pos, NULL, w->is64, packed, BATCH, &consumed);
+		pos += consumed;
+		count += n;
+		if (n < BATCH)
+			break;
+	}
+
+	return count;
+}
+
+static size_t run_sweep_parallel(const workload* w, const bench_config* cfg)
+{
+	return ldasm_sweep_parallel(w->code, w->len, NULL, w->is64, NULL, all_lengths, w->len, NULL, cfg->threads);
+}
+
+/* helpers: size consecutive procedures, and resolve a jump at every 5th byte */
+static size_t run_size_of_proc(const workload* w, const bench_config* cfg)
+{
+	size_t pos = 0, count = 0;
+	(void)cfg;
+
+	while (pos < w->len) {
+		size_t n = ldasm_size_of_proc_ex(w->code + pos, w->len - pos, NULL, w->is64);
+		if (n == LDASM_TRUNCATED)
+			break;
+		pos += n;
+		++count;
+	}
+
+	return count;
+}
+
+static size_t run_resolve_jmp(const workload* w, const bench_config* cfg)
+{
+	size_t count = 0;
+	(void)cfg;
+
+	for (size_t pos = 0; pos + 5 <= w->len; pos += 5) {
+		if (ldasm_resolve_jmp_ex(w->code + pos, w->code, w->len, NULL, w->is64))
+			++count;
+	}
+
+	return count;
+}
+
+/* relocate a 5 byte hook prologue at every instruction boundary to a block 1 GB away */
+static size_t run_relocate(const workload* w, const bench_config* cfg)
+{
+	uint8_t block[128];
+	ldasm_insn ld;
+	size_t pos = 0, count = 0, copied;
+	(void)cfg;
+
+	while (pos + 64 <= w->len) {
+		uint64_t at = (uint64_t)(uintptr_t)(w->code + pos) + (1ull << 30);
+		ldasm_relocate(w->code + pos, 5, block, sizeof(block), at, NULL, w->is64, &copied);
+		++count;
+
+		size_t n = ldasm_ex(w->code + pos, w->len - pos, NULL, &ld, w->is64);
+		if (n == LDASM_TRUNCATED)
+			break;
+		pos += n;
+	}
+
+	return count;
+}
+
+/* walk the first HOT_BYTES of code over and over, as a hook engine revisits the same addresses */
+static size_t run_hot_ldasm(const workload* w, const bench_config* cfg)
+{
+	ldasm_insn ld;
+	size_t count = 0, end = w->len < HOT_BYTES ? w->len : HOT_BYTES;
+	(void)cfg;
+
+	for (int pass = 0; pass < HOT_PASSES; pass++) {
+		for (size_t pos = 0, n; pos + 16 <= end; pos += n, ++count)
+			n = ldasm(w->code + pos, NULL, &ld, w->is64);
+	}
+
+	return count;
+}
+
+static size_t run_hot_cache(const workload* w, const bench_config* cfg)
+{
+	ldasm_insn ld;
+	size_t count = 0, end = w->len < HOT_BYTES ? w->len : HOT_BYTES;
+	(void)cfg;
+
+	cache.is64 = w->is64;
+	ldasm_cache_clear(&cache);
+
+	for (int pass = 0; pass < HOT_PASSES; pass++) {
+		for (size_t pos = 0, n; pos + 16 <= end; pos += n, ++count)
+			n = ldasm_cache_decode(&cache, w->code + pos, &ld);
+	}
+
+	return count;
+}
+
+/* contention: every thread replays the same hot set and retires one 16 byte block per pass */
+typedef enum _contention_mode
+{
+	CONTEND_LDASM,
+	CONTEND_MUTEX,
+	CONTEND_SHARED,
+} contention_mode;
+
+typedef struct _contention_job
+{
+	const workload*     w;
+	contention_mode     mode;
+	unsigned            index;
+	pthread_barrier_t*  start;
+	size_t              count;
+	pthread_t           thread;
+} contention_job;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static ldasm_shared_cache shared;
+
+static void* contention_thread(void* arg)
+{
+	contention_job* job = (contention_job*)arg;
+	const workload* w = job->w;
+	size_t end = w->len < HOT_BYTES ? w->len : HOT_BYTES;
+	ldasm_insn ld;
+
+	pthread_barrier_wait(job->start);
+
+	for (int pass = 0; pass < HOT_PASSES; pass++) {
+		for (size_t pos = 0, n; pos + 16 <= end; pos += n, ++job->count) {
+			if (job->mode == CONTEND_SHARED) {
+				n = ldasm_shared_cache_decode(&shared, w->code + pos, &ld);
+			}
+			else if (job->mode == CONTEND_MUTEX) {
+				pthread_mutex_lock(&cache_lock);
+				n = ldasm_cache_decode(&cache, w->code + pos, &ld);
+				pthread_mutex_unlock(&cache_lock);
+			}
+			else {
+				n = ldasm(w->code + pos, NULL, &ld, w->is64);
+			} //if
+		}
+
+		/* a hot set of 16 bytes or less has nothing to invalidate inside it */
+		if (end <= 16)
+			continue;
+
+		size_t at = (job->index * 4099 + (size_t)pass * 257) % (end - 16);
+		if (job->mode == CONTEND_SHARED) {
+			ldasm_shared_cache_invalidate(&shared, w->code + at, 16);
+		}
+		else if (job->mode == CONTEND_MUTEX) {
+			pthread_mutex_lock(&cache_lock);
+			ldasm_cache_invalidate(&cache, w->code + at, 16);
+			pthread_mutex_unlock(&cache_lock);
+		} //if
+	}
+
+	return NULL;
+}
+
+/* lookups per second over all threads, best of reps */
+static double contend(const workload* w, contention_mode mode, unsigned threads, const bench_config* cfg)
+{
+	contention_job jobs[64];
+	pthread_barrier_t start;
+	double best = 0;
+
+	for (int r = 0; r < cfg->reps; r++) {
+		size_t total = 0;
+		unsigned started = 0;
+
+		cache.is64 = shared.is64 = w->is64;
+		ldasm_cache_clear(&cache);
+		ldasm_shared_cache_flush(&shared);
+
+		if (pthread_barrier_init(&start, NULL, threads + 1) != 0)
+			return 0;
+
+		for (; started < threads; started++) {
+			jobs[started] = (contention_job){ .w = w, .mode = mode, .index = started, .start = &start };
+			if (pthread_create(&jobs[started].thread, NULL, contention_thread, &jobs[started]) != 0)
+				break;
+		}
+
+		/* threads that failed to start still owe the barrier their arrival */
+		if (started < threads) {
+			fprintf(stderr, "could only start %u threads\n", started);
+			exit(1);
+		} //if
+
+		double t = now_sec();
+		pthread_barrier_wait(&start);
+
+		for (unsigned i = 0; i < threads; i++) {
+			pthread_join(jobs[i].thread, NULL);
+			total += jobs[i].count;
+		}
+
+		t = now_sec() - t;
+		pthread_barrier_destroy(&start);
+
+		if (t > 0 && total / t > best)
+			best = total / t;
+	}
+
+	return best;
+}
+
+static void contention(const workload* w, const bench_config* cfg)
+{
+	ldasm_cache_stats stats;
+
+	printf("%s: contention, M lookups/s over all threads\n", w->name);
+	printf("  %-8s %12s %12s %12s\n", "threads", "ldasm", "mutex cache", "shared cache");
+
+	for (unsigned threads = 1; threads <= 64; threads *= 2) {
+		double plain = contend(w, CONTEND_LDASM, threads, cfg);
+		double locked = contend(w, CONTEND_MUTEX, threads, cfg);
+		double shared_rate = contend(w, CONTEND_SHARED, threads, cfg);
+
+		printf("  %-8u %12.2f %12.2f %12.2f\n", threads, plain / 1e6, locked / 1e6, shared_rate / 1e6);
+	}
+
+	ldasm_shared_cache_stats(&shared, &stats);
+	printf("  shared cache: %llu hits, %llu misses, %llu evictions, %llu contended inserts\n",
+		(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+		(unsigned long long)stats.evictions, (unsigned long long)stats.contended);
+}
+
+typedef enum _rle_op
+{
+	RLE_COMPRESS,
+	RLE_COMPRESS_EX,
+	RLE_DECOMPRESS,
+	RLE_DECOMPRESS_EX,
+	RLE_STREAM,
+} rle_op;
+
+typedef struct _rle_blob
+{
+	const char* name;
+	uint8_t*    data;
+	size_t      len;
+	uint8_t*    packed;
+	size_t      packed_len;
+	uint8_t*    out;
+} rle_blob;
+
+static size_t run_rle(rle_op op, rle_blob* b)
+{
+	rle_stream stream;
+	size_t in_pos = 0, out_pos = 0, used;
+
+	switch (op) {
+	case RLE_COMPRESS:
+		return compress_rle(b->out, b->data, b->len);
+	case RLE_COMPRESS_EX:
+		return compress_rle_ex(b->out, compress_rle_bound(b->len), b->data, b->len);
+	case RLE_DECOMPRESS:
+		return decompress_rle(b->out, b->packed, b->packed_len);
+	case RLE_DECOMPRESS_EX:
+		return decompress_rle_ex(b->out, b->len, b->packed, b->packed_len);
+	case RLE_STREAM:
+		/* input arrives in chunks, output is drained in chunks */
+		rle_stream_init(&stream);
+		while (in_pos < b->packed_len) {
+			size_t in_size = b->packed_len - in_pos < RLE_CHUNK ? b->packed_len - in_pos : RLE_CHUNK;
+			size_t out_cap = b->len - out_pos < 4 * RLE_CHUNK ? b->len - out_pos : 4 * RLE_CHUNK;
+			out_pos += rle_stream_decompress(&stream, b->out + out_pos, out_cap, b->packed + in_pos, in_size, &used);
+			in_pos += used;
+		}
+		return out_pos;
+	}
+
+	return 0;
+}
+
+static void free_blobs(rle_blob* blobs, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		free(blobs[i].data);
+		free(blobs[i].packed);
+		free(blobs[i].out);
+	}
+}
+
+static void rle_codec(const workload* w, const bench_config* cfg)
+{
+	static const char* const ops[] = { "compress_rle", "compress_rle_ex", "decompress_rle", "decompress_rle_ex",
+		"rle_stream 4K chunks" };
+	rle_blob blobs[3] = {
+		{ .name = "instruction lengths" },
+		{ .name = "packed instructions" },
+		{ .name = "run-heavy index" },
+	};
+	size_t consumed;
+	bool ok = true;
+
+	for (size_t i = 0; i < 3; i++) {
+		blobs[i].data = malloc(RLE_BLOB_SIZE);
+		blobs[i].packed = malloc(compress_rle_bound(RLE_BLOB_SIZE));
+		blobs[i].out = malloc(compress_rle_bound(RLE_BLOB_SIZE));
+		ok = ok && blobs[i].data && blobs[i].packed && blobs[i].out;
+	}
+
+	if (!ok) {
+		free_blobs(blobs, 3);
+		return;
+	} //if
+
+	/* the code is swept over and over until each blob is full */
+	for (size_t pos = 0; pos < RLE_BLOB_SIZE;) {
+		size_t n = ldasm_sweep_lengths(w->code, w->len, NULL, w->is64, blobs[0].data + pos, RLE_BLOB_SIZE - pos, &consumed);
+		if (!n)
+			break;
+		pos += n;
+		blobs[0].len = pos;
+	}
+
+	for (size_t pos = 0; pos < RLE_BLOB_SIZE / 4;) {
+		size_t n = ldasm_sweep_packed(w->code, w->len, NULL, w->is64, (uint32_t*)blobs[1].data + pos,
+			RLE_BLOB_SIZE / 4 - pos, &consumed);
+		if (!n)
+			break;
+		pos += n;
+		blobs[1].len = pos * 4;
+	}
+
+	/* runs of 1 to 64 bytes over a few values, like a sorted or sparse index */
+	for (size_t pos = 0; pos < RLE_BLOB_SIZE;) {
+		size_t run = 1 + rng() % 64;
+		uint8_t v = (uint8_t)(rng() % 4);
+		for (size_t k = 0; k < run && pos < RLE_BLOB_SIZE; k++)
+			blobs[2].data[pos++] = v;
+		blobs[2].len = pos;
+	}
+
+	printf("%s: RLE codec, MB/s of uncompressed bytes\n", w->name);
+	printf("  %-22s %10s %10s %10s\n", "", blobs[0].name, blobs[1].name, blobs[2].name);
+
+	for (size_t i = 0; i < 3; i++)
+		blobs[i].packed_len = compress_rle_ex(blobs[i].packed, compress_rle_bound(blobs[i].len), blobs[i].data, blobs[i].len);
+
+	for (size_t op = 0; op < sizeof(ops) / sizeof(ops[0]); op++) {
+		printf("  %-22s", ops[op]);
+
+		for (size_t i = 0; i < 3; i++) {
+			double best = 0;
+			size_t size = run_rle((rle_op)op, &blobs[i]);
+
+			/* the decoders must give the blob back */
+			if (op >= RLE_DECOMPRESS && (size != blobs[i].len || memcmp(blobs[i].out, blobs[i].data, size) != 0)) {
+				printf(" %10s", "mismatch");
+				continue;
+			} //if
+
+			for (int r = 0; r < cfg->reps; r++) {
+				double t = now_sec();
+				for (int k = 0; k < cfg->iterations; k++)
+					run_rle((rle_op)op, &blobs[i]);
+				t = now_sec() - t;
+
+				if (r == 0 || t < best)
+					best = t;
+			}
+
+			printf(" %10.1f", (double)blobs[i].len * cfg->iterations / best / 1e6);
+		}
+
+		printf("\n");
+	}
+
+	printf("  %-22s", "ratio");
+	for (size_t i = 0; i < 3; i++)
+		printf(" %10.2f", blobs[i].packed_len ? (double)blobs[i].len / blobs[i].packed_len : 0.0);
+	printf("\n");
+
+	free_blobs(blobs, 3);
+}
+
+typedef struct _bench_method
+{
+	const char* name;
+	size_t (*run)(const workload* w, const bench_config* cfg);
+} bench_method;
+
+static void measure(const workload* w, const bench_method* m, const bench_config* cfg)
+{
+	double best = 0;
+	uint64_t best_ticks = 0;
+	size_t units = m->run(w, cfg); /* warm up */
+
+	for (int r = 0; r < cfg->reps; r++) {
+		double t = now_sec();
+		uint64_t ticks = now_ticks();
+
+		for (int i = 0; i < cfg->iterations; i++)
+			units = m->run(w, cfg);
+
+		ticks = now_ticks() - ticks;
+		t = now_sec() - t;
+
+		if (r == 0 || t < best) {
+			best = t;
+			best_ticks = ticks;
+		} //if
+	}
+
+	double bytes = (double)w->len * cfg->iterations;
+	double total = (double)units * cfg->iterations;
+
+	printf("  %-22s %9.1f MB/s %9.2f M/s", m->name, bytes / best / 1e6, total / best / 1e6);
+#ifdef HAVE_TSC
+	printf(" %8.1f cycles/unit", total > 0 ? (double)best_ticks / total : 0.0);
+#else
+	(void)best_ticks;
+#endif
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	bench_config cfg = { 10, 5, 0 };
+	workload w[64];
+	size_t count = 0;
+
+	if (!ldasm_default_tables() || !ldasm_cache_init(&cache, HOT_BYTES / 2, NULL, true) ||
+		!ldasm_shared_cache_init(&shared, HOT_BYTES / 2, NULL, true))
+		return 1;
+
+	count += make_synthetic(w);
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+			cfg.iterations = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+			cfg.reps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			cfg.threads = (unsigned)atoi(argv[++i]);
+		else if (count < 64 && make_text(&w[count], argv[i]))
+			++count;
+		else
+			fprintf(stderr, "skipping %s\n", argv[i]);
+	}
+
+	if (count == SYNTHETIC_COUNT && make_text(&w[count], argv[0]))
+		++count;
+
+	if (cfg.iterations < 1)
+		cfg.iterations = 1;
+	if (cfg.reps < 1)
+		cfg.reps = 1;
+
+	unsigned max_threads = cfg.threads ? cfg.threads : 8;
+
+	static const bench_method sweeps[] = {
+		{ "ldasm_ex loop", run_ldasm },
+		{ "ldasm_sweep", run_sweep },
+		{ "ldasm_sweep_soa", run_sweep_soa },
+		{ "ldasm_sweep_packed", run_sweep_packed },
+		{ "ldasm_sweep_lengths", run_sweep_lengths },
+	};
+
+	static const bench_method helpers[] = {
+		{ "ldasm_size_of_proc_ex", run_size_of_proc },
+		{ "ldasm_resolve_jmp_ex", run_resolve_jmp },
+		{ "ldasm_relocate", run_relocate },
+		{ "ldasm hot set", run_hot_ldasm },
+		{ "ldasm_cache hot set", run_hot_cache },
+	};
+
+	printf("iterations %d, best of %d, units are instructions (procedures / jumps / relocations for helpers)\n",
+		cfg.iterations, cfg.reps);
+
+	for (size_t i = 0; i < count; i++) {
+		all_lengths = malloc(w[i].len);
+		if (!all_lengths)
+			return 1;
+
+		printf("%s: %zu bytes\n", w[i].name, w[i].len);
+
+		for (size_t k = 0; k < sizeof(sweeps) / sizeof(sweeps[0]); k++)
+			measure(&w[i], &sweeps[k], &cfg);
+
+		/* parallel sweep scaling, one output slot per byte so each sweep covers the whole workload */
+		for (unsigned threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+			char name[32];
+			bench_config scaled = cfg;
+			snprintf(name, sizeof(name), "ldasm_sweep_parallel/%u", threads);
+			scaled.threads = threads;
+			measure(&w[i], &(bench_method){ name, run_sweep_parallel }, &scaled);
+
+			/* the limit is measured last even when it is no power of two */
+			if (threads >= max_threads)
+				break;
+		}
+
+		/* helpers on real code only, synthetic streams have no procedures */
+		for (size_t k = 0; i >= SYNTHETIC_COUNT && k < sizeof(helpers) / sizeof(helpers[0]); k++)
+			measure(&w[i], &helpers[k], &cfg);
+
+		if (i == count - 1 && i >= SYNTHETIC_COUNT) {
+			contention(&w[i], &cfg);
+			rle_codec(&w[i], &cfg);
+		} //if
+
+		free(all_lengths);
+		free(w[i].code);
+	}
+
+	ldasm_cache_free(&cache);
+	ldasm_shared_cache_free(&shared);
+	return 0;
+}
@@ -1,22 +1,14 @@
-#include "ldasm.h"
+#include "ldasm_internal.h"
 #include "rle.h"
 
 #include <memory.h>
+#include <stdlib.h>
 
-// Instruction format:
-// | prefix | REX | opcode | modR/M | SIB | disp8/16/32 | imm8/16/32/64 |
-
-#define OP_NONE             0x00
-#define OP_INVALID          0x80
-
-#define OP_DATA_I8          0x01
-#define OP_DATA_I16         0x02
-#define OP_DATA_I16_I32     0x04
-#define OP_DATA_I16_I32_I64 0x08
-#define OP_EXTENDED         0x10
-#define OP_RELATIVE         0x20
-#define OP_MODRM            0x40
-#define OP_PREFIX           0x80
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <stdatomic.h>
+#endif
 
 static bool decompress_lookup_table(uint8_t* out, size_t size)
 {
@@ -33,9 +25,7 @@ static bool decompress_lookup_table(uint8_t* out, size_t size)
 		0x80000421, 0x02800200, 0x03400200, 0x40020006,
 	};
 
-	decompress_rle(out, lookup_table, lookup_table_len);
-
-	return true;
+	return decompress_rle_ex(out, size, (const uint8_t*)lookup_table, lookup_table_len) == size;
 }
 
 static bool decompress_lookup_table_ex(uint8_t* out, size_t size)
@@ -43,17 +33,15 @@ static bool decompress_lookup_table_ex(uint8_t* out, size_t size)
 	if (!out || size != 256)
 		return false;
 
-	size_t lookup_table_ex_len = 83;
+	size_t lookup_table_ex_len = 78;
 
 	uint32_t lookup_table_ex[] = {
-		0x80400405, 0x00800005, 0x16804080, 0x06400941, 0x40040080, 0x06408050, 0x06400880, 0x50008000,
-		0x05EF5180, 0x04403080, 0x00400341, 0x80024002, 0x10C74004, 0x03401024, 0x40414000, 0x00038002,
-		0x0D414094, 0x40074140, 0x41034041, 0x00084006, 0x0080402F,
+		0x80400405, 0x00800005, 0xC2804080, 0x50401441, 0x08804080, 0xE0000640, 0x80500080, 0x30800551,
+		0xFD410440, 0x02004003, 0x04800240, 0x10241040, 0x98000340, 0x02404140, 0x40000380, 0xD2400D41,
+		0x41400741, 0x40410340, 0x402F0008, 0x00008000,
 	};
 
-	decompress_rle(out, lookup_table_ex, lookup_table_ex_len);
-
-	return true;
+	return decompress_rle_ex(out, size, (const uint8_t*)lookup_table_ex, lookup_table_ex_len) == size;
 }
 
 bool ldasm_init(ldasm_tables* tables)
@@ -70,39 +58,119 @@ bool ldasm_init(ldasm_tables* tables)
 	return true;
 }
 
-size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool is64)
+/* built-in tables, decompressed once on first use */
+static LDASM_ALIGN(64) ldasm_tables default_tables;
+
+#if defined(_WIN32)
+static INIT_ONCE default_tables_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK init_default_tables(PINIT_ONCE once, PVOID param, PVOID* ctx)
 {
-	if (!code || !tables || !ld)
-		return 0;
+	(void)once; (void)param; (void)ctx;
+	return ldasm_init(&default_tables) ? TRUE : FALSE;
+}
+
+const ldasm_tables* ldasm_default_tables(void)
+{
+	if (!InitOnceExecuteOnce(&default_tables_once, init_default_tables, NULL, NULL))
+		return NULL;
+
+	return &default_tables;
+}
+#else
+/* 0 - not initialized, 1 - initializing, 2 - ready */
+static atomic_int default_tables_state;
+
+const ldasm_tables* ldasm_default_tables(void)
+{
+	int state = atomic_load_explicit(&default_tables_state, memory_order_acquire);
+
+	if (state != 2) {
+		int expected = 0;
+		if (atomic_compare_exchange_strong(&default_tables_state, &expected, 1)) {
+			ldasm_init(&default_tables);
+			atomic_store_explicit(&default_tables_state, 2, memory_order_release);
+		}
+		else {
+			while (atomic_load_explicit(&default_tables_state, memory_order_acquire) != 2)
+				;
+		} //if
+	} //if
+
+	return &default_tables;
+}
+#endif
+
+/* ModR/M and immediate flags of the VEX (C4/C5), EVEX (62) and XOP (8F) opcode maps */
+static inline uint8_t vex_map_flags(const ldasm_tables* tables, uint8_t escape, uint8_t map, uint8_t op)
+{
+	if (escape == 0x8F) {
+		switch (map) {
+		case 8u:  return OP_MODRM | OP_DATA_I8;
+		case 9u:  return OP_MODRM;
+		case 10u: return OP_MODRM | OP_DATA_I16_I32;
+		default:  return OP_INVALID;
+		}
+	} //if
+
+	switch (map) {
+	case 1u:
+		/* 0F map, the legacy table knows which opcodes take ModR/M and imm8 */
+		return (tables->flags_ex[op] & OP_EXTENDED) ? OP_INVALID : tables->flags_ex[op];
+	case 2u:
+		return OP_MODRM;
+	case 3u:
+		return OP_MODRM | OP_DATA_I8;
+	case 4u:
+		/* APX promoted legacy instructions */
+		return escape == 0x62 ? tables->flags[op] : OP_INVALID;
+	case 5u:
+	case 6u:
+		return escape == 0x62 ? OP_MODRM : OP_INVALID;
+	default:
+		return OP_INVALID;
+	}
+}
 
+/* bounded decoder core, returns LDASM_TRUNCATED if the instruction does not fit into avail bytes */
+static inline size_t decode_insn(const void* code, size_t avail, const ldasm_tables* tables, ldasm_insn* ld, bool is64)
+{
 	uint8_t* p = (uint8_t*)code;
-	uint8_t s, op, f;
+	uint8_t s, op, f, map;
 	uint8_t rexw, pr_66, pr_67;
 
-	s = rexw = pr_66 = pr_67 = 0;
+	s = rexw = pr_66 = pr_67 = map = 0;
+	LDASM_STATS_BEGIN();
 
 	/* init output data */
 	memset(ld, 0, sizeof(ldasm_insn));
 
 	/* phase 1: parse prefixies */
-	while (tables->flags[*p] & OP_PREFIX) {
+	while (s < avail && tables->flags[*p] & OP_PREFIX) {
 		if (*p == 0x66) pr_66 = 1u;
 		if (*p == 0x67) pr_67 = 1u;
 		++p; ++s;
 		ld->flags |= DF_PREFIX;
+		LDASM_COUNT(prefix_bytes);
 		if (s == 15u) {
 			ld->flags |= DF_INVALID;
 			return s;
 		} //if
 	}
 
+	if (s >= avail)
+		return LDASM_TRUNCATED;
+
 	if (is64) {
 		/* parse REX prefix */
 		if (*p >> 4u == 4u) {
 			ld->rex = *p;
 			rexw = (ld->rex >> 3u) & 1u;
 			ld->flags |= DF_REX;
+			LDASM_COUNT(rex);
 			++p; ++s;
+			if (s >= avail)
+				return LDASM_TRUNCATED;
 		} //if
 
 		/* can be only one REX prefix */
@@ -116,48 +184,112 @@ size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool
 	ld->opcd_offset = (uint8_t)(p - (uint8_t*)code);
 	ld->opcd_size = 1;
 	op = *p++; ++s;
+	LDASM_COUNT_OPCODE(opcode, op);
 
 	/* is 2 byte opcode? */
 	if (op == 0x0F) {
+		if (s >= avail)
+			return LDASM_TRUNCATED;
 		op = *p++; ++s;
 		++ld->opcd_size;
+		map = 1;
 		f = tables->flags_ex[op];
+		LDASM_COUNT(two_byte);
+		LDASM_COUNT_OPCODE(opcode_0f, op);
 		if (f & OP_INVALID) {
 			ld->flags |= DF_INVALID;
 			return s;
 		} //if
 		/* for SSE instructions */
 		if (f & OP_EXTENDED) {
+			if (s >= avail)
+				return LDASM_TRUNCATED;
 			op = *p++; ++s;
 			++ld->opcd_size;
+			LDASM_COUNT(three_byte);
+		} //if
+	}
+	else if (op == 0xC4 || op == 0xC5 || op == 0x62 || op == 0x8F) {
+		if (s >= avail)
+			return LDASM_TRUNCATED;
+
+		/* outside 64-bit mode C4/C5/62 are LES/LDS/BOUND unless mod == 3,
+		   8F is POP r/m unless the XOP map select is 8 or above */
+		if (op == 0x8F ? (*p & 0x1F) >= 8 : (is64 || (*p >> 6) == 3)) {
+			ld->vex_offset = ld->opcd_offset;
+			ld->vex_size = op == 0xC5 ? 2 : (op == 0x62 ? 4 : 3);
+
+			for (uint8_t i = 1; i < ld->vex_size; i++) {
+				if (s >= avail)
+					return LDASM_TRUNCATED;
+				ld->vex[i - 1] = *p++; ++s;
+			}
+
+			/* C5 implies the 0F map, EVEX selects it with 3 bits, VEX and XOP with 5 */
+			if (op == 0xC5)
+				map = 1;
+			else if (op == 0x62)
+				map = ld->vex[0] & 7;
+			else
+				map = ld->vex[0] & 0x1F;
+
+			if (s >= avail)
+				return LDASM_TRUNCATED;
+
+			f = vex_map_flags(tables, op, map, *p);
+			ld->opcd_offset = (uint8_t)(p - (uint8_t*)code);
+			op = *p++; ++s;
+			LDASM_COUNT(vex);
+			LDASM_COUNT_OPCODE(opcode_vex, op);
+
+			if (f & OP_INVALID) {
+				ld->flags |= DF_INVALID;
+				return s;
+			} //if
+		}
+		else {
+			f = tables->flags[op];
 		} //if
 	}
 	else {
 		f = tables->flags[op];
-		/* pr_66 = pr_67 for opcodes A0-A3 */
-		if (op >= 0xA0 && op <= 0xA3) pr_66 = pr_67;
+		/* moffs of opcodes A0-A3 follows the address size, not the operand size */
+		if (op >= 0xA0 && op <= 0xA3) {
+			ld->imm_size = (uint8_t)((is64 ? 8u : 4u) >> pr_67);
+			f &= ~(OP_DATA_I8 | OP_DATA_I16 | OP_DATA_I16_I32 | OP_DATA_I16_I32_I64);
+		} //if
 	} //if
 
 	/* phase 3: parse ModR/M, SIB and DISP */
 	if (f & OP_MODRM) {
+		if (s >= avail)
+			return LDASM_TRUNCATED;
+
 		uint8_t mod = (*p >> 6);
+		/* MOV to/from CR/DR/TR (0F 20-23, 0F 26) always uses register operands, mod is ignored */
+		if (ld->opcd_size == 2 && ((op >= 0x20 && op <= 0x23) || op == 0x26))
+			mod = 3;
 		uint8_t ro = (*p & 0x38) >> 3;
 		uint8_t rm = (*p & 7);
 
 		ld->modrm = *p++; ++s;
 		ld->flags |= DF_MODRM;
+		LDASM_COUNT(modrm);
 
 		/* in F6,F7 opcodes immediate data present if R/O == 0 */
-		if (op == 0xF6 && (ro == 0 || ro == 1))
+		if ((map == 0 || map == 4) && op == 0xF6 && (ro == 0 || ro == 1))
 			f |= OP_DATA_I8;
-		if (op == 0xF7 && (ro == 0 || ro == 1))
+		if ((map == 0 || map == 4) && op == 0xF7 && (ro == 0 || ro == 1))
 			f |= OP_DATA_I16_I32_I64;
 
 
 		/* is SIB byte exist? */
 		if (mod != 3 && rm == 4 && (is64 || !pr_67)) {
+			if (s >= avail)
+				return LDASM_TRUNCATED;
 			ld->sib = *p++; ++s;
 			ld->flags |= DF_SIB;
+			LDASM_COUNT(sib);
 
 			/* if base == 5 and mod == 0 */
 			if ((ld->sib & 7) == 5 && mod == 0) {
@@ -181,6 +313,7 @@ size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool
 			} //if
 			break;
 		case 1u:
+			/* also EVEX compressed disp8, the scale does not change the size */
 			ld->disp_size = 1u;
 			break;
 		case 2u:
@@ -198,6 +331,7 @@ size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool
 			p += ld->disp_size;
 			s += ld->disp_size;
 			ld->flags |= DF_DISP;
+			LDASM_COUNT(disp);
 		} //if
 	}
 
@@ -214,7 +348,7 @@ size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool
 	if ((is64 && rexw && (op >= 0xB8 && op <= 0xBF)) && (f & OP_DATA_I16_I32_I64)) {
 		ld->imm_size = 8u;
 	}
-	else if (f & OP_DATA_I16_I32_I64) {
+	else if (f & (OP_DATA_I16_I32 | OP_DATA_I16_I32_I64)) {
 		ld->imm_size = 4u - (pr_66 << 1u);
 	}
 
@@ -225,16 +359,209 @@ size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool
 		s += ld->imm_size;
 		ld->imm_offset = (uint8_t)(p - (uint8_t*)code);
 		ld->flags |= DF_IMM;
+		LDASM_COUNT(imm);
 		if (f & OP_RELATIVE)
 			ld->flags |= DF_RELATIVE;
 	} //if
 
+	/* displacement or immediate data is cut off */
+	if (s > avail)
+		return LDASM_TRUNCATED;
+
 	/* instruction is too long */
 	if (s > 15u) ld->flags |= DF_INVALID;
 
 	return s;
 }
 
+/* decoder entry of every path, counts the outcome when built with LDASM_STATS */
+static inline size_t ldasm_decode(const void* code, size_t avail, const ldasm_tables* tables, ldasm_insn* ld, bool is64)
+{
+	size_t n = decode_insn(code, avail, tables, ld, is64);
+
+#ifdef LDASM_STATS
+	LDASM_STATS_BEGIN();
+	LDASM_COUNT(decodes);
+	if (n == LDASM_TRUNCATED) {
+		LDASM_COUNT(truncated);
+	}
+	else {
+		LDASM_COUNT_ADD(bytes, n);
+		if (ld->flags & DF_INVALID)
+			LDASM_COUNT(invalid);
+	} //if
+#endif
+
+	return n;
+}
+
+size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool is64)
+{
+	if (!code || !ld)
+		return 0;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	return ldasm_decode(code, SIZE_MAX, tables, ld, is64);
+}
+
+size_t ldasm_ex(const void* code, size_t avail, const ldasm_tables* tables, ldasm_insn* ld, bool is64)
+{
+	if (!code || !ld)
+		return 0;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	return ldasm_decode(code, avail, tables, ld, is64);
+}
+
+size_t ldasm_sweep(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	ldasm_insn* out, uint8_t* lengths, size_t cap, size_t* consumed)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	size_t pos = 0, count = 0;
+	ldasm_insn scratch;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	if (p) {
+		while (count < cap && pos < len) {
+			ldasm_insn* ld = out ? &out[count] : &scratch;
+			size_t n = ldasm_decode(p + pos, len - pos, tables, ld, is64);
+
+			/* instruction crosses the end of the buffer */
+			if (n == LDASM_TRUNCATED)
+				break;
+
+			if (lengths)
+				lengths[count] = (uint8_t)n;
+
+			pos += n;
+			++count;
+		}
+	} //if
+
+	if (consumed)
+		*consumed = pos;
+
+	return count;
+}
+
+size_t ldasm_sweep_soa(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	const ldasm_soa* out, size_t cap, size_t* consumed)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	size_t pos = 0, count = 0;
+	ldasm_soa soa = { 0 };
+	ldasm_insn ld;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	if (out)
+		soa = *out;
+
+	if (p) {
+		while (count < cap && pos < len) {
+			size_t n = ldasm_decode(p + pos, len - pos, tables, &ld, is64);
+			if (n == LDASM_TRUNCATED)
+				break;
+
+			if (soa.length)
+				soa.length[count] = (uint8_t)n;
+			if (soa.flags)
+				soa.flags[count] = ld.flags;
+			if (soa.opcd_offset)
+				soa.opcd_offset[count] = ld.opcd_offset;
+			if (soa.disp_offset)
+				soa.disp_offset[count] = ld.disp_offset;
+			if (soa.disp_size)
+				soa.disp_size[count] = ld.disp_size;
+			if (soa.imm_offset)
+				soa.imm_offset[count] = ld.imm_offset;
+			if (soa.imm_size)
+				soa.imm_size[count] = ld.imm_size;
+
+			pos += n;
+			++count;
+		}
+	} //if
+
+	if (consumed)
+		*consumed = pos;
+
+	return count;
+}
+
+static inline uint32_t pack(const ldasm_insn* ld, size_t length)
+{
+	uint32_t v = ld->flags | (uint32_t)(length & 0x1F) << 8;
+
+	if (length > 15)
+		return v;
+
+	/* displacement size 0, 1, 2 or 4 is stored as 0, 1, 2, 3 */
+	v |= (uint32_t)ld->opcd_offset << 13;
+	v |= (uint32_t)ld->disp_offset << 17;
+	v |= (uint32_t)(ld->disp_size == 4 ? 3 : ld->disp_size) << 21;
+	v |= (uint32_t)ld->imm_offset << 23;
+	v |= (uint32_t)ld->imm_size << 27;
+	return v;
+}
+
+uint32_t ldasm_pack(const ldasm_insn* ld, size_t length)
+{
+	return ld ? pack(ld, length) : 0;
+}
+
+size_t ldasm_unpack(uint32_t packed, ldasm_insn* ld)
+{
+	if (ld) {
+		memset(ld, 0, sizeof(ldasm_insn));
+		ld->flags = LDASM_PACKED_FLAGS(packed);
+		ld->opcd_offset = (uint8_t)LDASM_PACKED_OPCD_OFFSET(packed);
+		ld->disp_offset = (uint8_t)LDASM_PACKED_DISP_OFFSET(packed);
+		ld->disp_size = (uint8_t)LDASM_PACKED_DISP_SIZE(packed);
+		ld->imm_offset = (uint8_t)LDASM_PACKED_IMM_OFFSET(packed);
+		ld->imm_size = (uint8_t)LDASM_PACKED_IMM_SIZE(packed);
+	} //if
+
+	return LDASM_PACKED_LENGTH(packed);
+}
+
+size_t ldasm_sweep_packed(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	uint32_t* out, size_t cap, size_t* consumed)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	size_t pos = 0, count = 0;
+	ldasm_insn ld;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	if (p) {
+		while (count < cap && pos < len) {
+			size_t n = ldasm_decode(p + pos, len - pos, tables, &ld, is64);
+			if (n == LDASM_TRUNCATED)
+				break;
+
+			if (out)
+				out[count] = pack(&ld, n);
+
+			pos += n;
+			++count;
+		}
+	} //if
+
+	if (consumed)
+		*consumed = pos;
+
+	return count;
+}
+
 // from https://github.com/DarthTon/Blackbone/blob/master/src/BlackBone/Asm/LDasm.c#L775
 size_t ldasm_size_of_proc(void* proc, const ldasm_tables* tables, bool is64)
 {
@@ -265,21 +592,365 @@ size_t ldasm_size_of_proc(void* proc, const ldasm_tables* tables, bool is64)
 	return result;
 }
 
-// from https://github.com/DarthTon/Blackbone/blob/master/src/BlackBone/Asm/LDasm.c#L806
+size_t ldasm_size_of_proc_ex(const void* proc, size_t avail, const ldasm_tables* tables, bool is64)
+{
+	const uint8_t* p = (const uint8_t*)proc;
+	size_t length, result = 0;
+	ldasm_insn data;
+
+	if (!p)
+		return 0;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	while (result < avail) {
+		length = ldasm_decode(p + result, avail - result, tables, &data, is64);
+		if (length == LDASM_TRUNCATED)
+			break;
+
+		const uint8_t op = p[result + data.opcd_offset];
+		result += length;
+
+		if (length == 1 && (op == 0xCC || op == 0xC3))
+			return result;
+
+		if (length == 3 && op == 0xC2)
+			return result;
+	}
+
+	/* ran into the end of the buffer before a return */
+	return LDASM_TRUNCATED;
+}
+
+static inline bool cfg_test(const uint64_t* bits, size_t i)
+{
+	return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void cfg_set(uint64_t* bits, size_t i)
+{
+	bits[i >> 6] |= 1ull << (i & 63);
+}
+
+static bool cfg_push(size_t** work, size_t* count, size_t* cap, size_t offset)
+{
+	if (*count == *cap) {
+		size_t* p = realloc(*work, *cap * 2 * sizeof(size_t));
+		if (!p)
+			return false;
+		*work = p;
+		*cap *= 2;
+	} //if
+
+	(*work)[(*count)++] = offset;
+	return true;
+}
+
+size_t ldasm_size_of_proc_cfg(const void* proc, size_t limit, const ldasm_tables* tables, bool is64, size_t* blocks)
+{
+	const uint8_t* p = (const uint8_t*)proc;
+	size_t words = (limit + 63) / 64, count = 0, cap = 64, extent = 0;
+	bool truncated = false, ok = true;
+	ldasm_insn data;
+
+	if (blocks)
+		*blocks = 0;
+
+	if (!p || !limit)
+		return 0;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	/* instruction starts already decoded, and basic block leaders */
+	uint64_t* visited = calloc(words * 2, sizeof(uint64_t));
+	uint64_t* leaders = visited + words;
+	size_t* work = malloc(cap * sizeof(size_t));
+	if (!visited || !work) {
+		free(visited);
+		free(work);
+		return 0;
+	} //if
+
+	work[count++] = 0;
+	cfg_set(leaders, 0);
+
+	while (count && ok) {
+		size_t pos = work[--count];
+
+		while (pos < limit) {
+			/* ran into code that was already walked, which splits a block there */
+			if (cfg_test(visited, pos)) {
+				cfg_set(leaders, pos);
+				break;
+			} //if
+			cfg_set(visited, pos);
+
+			size_t length = ldasm_decode(p + pos, limit - pos, tables, &data, is64);
+			if (length == LDASM_TRUNCATED) {
+				truncated = true;
+				break;
+			} //if
+
+			const size_t end = pos + length;
+			if (end > extent)
+				extent = end;
+
+			if (data.flags & DF_INVALID)
+				break;
+
+			/* VEX/EVEX/XOP opcodes are never control flow */
+			const uint8_t op = p[pos + data.opcd_offset + data.opcd_size - 1];
+			const bool one = data.opcd_size == 1 && !data.vex_size;
+
+			/* ret, retf, int3, hlt, ud2 and indirect jumps end the path */
+			if (one && (op == 0xC3 || op == 0xC2 || op == 0xCB || op == 0xCA || op == 0xCC || op == 0xF4))
+				break;
+			if (data.opcd_size == 2 && op == 0x0B)
+				break;
+			if (one && op == 0xFF && (((data.modrm >> 3) & 7) == 4 || ((data.modrm >> 3) & 7) == 5))
+				break;
+
+			bool jmp = one && (op == 0xE9 || op == 0xEB);
+			bool jcc = (one && ((op >= 0x70 && op <= 0x7F) || (op >= 0xE0 && op <= 0xE3))) ||
+				(data.opcd_size == 2 && op >= 0x80 && op <= 0x8F);
+
+			if ((jmp || jcc) && (data.imm_size == 1 || data.imm_size == 4)) {
+				int32_t rel;
+				if (data.imm_size == 1) {
+					rel = (int8_t)p[pos + data.imm_offset];
+				}
+				else {
+					memcpy(&rel, p + pos + data.imm_offset, sizeof(rel));
+				} //if
+
+				/* targets outside [proc, proc + limit) are tail calls */
+				int64_t target = (int64_t)end + rel;
+				if (target >= 0 && (uint64_t)target < limit) {
+					cfg_set(leaders, (size_t)target);
+					if (!cfg_push(&work, &count, &cap, (size_t)target)) {
+						ok = false;
+						break;
+					} //if
+				} //if
+			} //if
+
+			if (jmp)
+				break;
+
+			if (jcc && end < limit)
+				cfg_set(leaders, end);
+
+			pos = end;
+		}
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < words; i++)
+		n += ldasm_popcount64(leaders[i]);
+
+	free(work);
+	free(visited);
+
+	if (!ok)
+		return 0;
+
+	if (blocks)
+		*blocks = n;
+
+	/* a path ran into the limit */
+	return truncated ? LDASM_TRUNCATED : extent;
+}
+
+/* one thunk hop: E9 rel32, EB rel8 or FF 25 (jmp [rip+disp32], jmp [disp32] in 32-bit code),
+   optionally behind endbr64/endbr32. lo/hi bound the bytes that may be read, NULL when unbounded */
+static uint8_t* jmp_hop(uint8_t* p, const uint8_t* lo, const uint8_t* hi, const ldasm_tables* tables, bool is64,
+	bool* truncated)
+{
+	ldasm_insn data;
+	size_t avail = hi ? (size_t)(hi - p) : SIZE_MAX;
+	size_t length = ldasm_decode(p, avail, tables, &data, is64);
+
+	if (length == 4 && p[0] == 0xF3 && p[1] == 0x0F && p[2] == 0x1E && (p[3] == 0xFA || p[3] == 0xFB)) {
+		p += 4;
+		avail = hi ? (size_t)(hi - p) : SIZE_MAX;
+		length = avail ? ldasm_decode(p, avail, tables, &data, is64) : LDASM_TRUNCATED;
+	} //if
+
+	if (length == LDASM_TRUNCATED) {
+		*truncated = true;
+		return NULL;
+	} //if
+
+	/* operand or address size prefixes change the form, bnd/notrack/REX.W do not */
+	if (data.vex_size || data.opcd_size != 1 || memchr(p, 0x66, data.opcd_offset) || memchr(p, 0x67, data.opcd_offset))
+		return NULL;
+
+	const uint8_t op = p[data.opcd_offset];
+
+	if (op == 0xE9 && data.imm_size == 4) {
+		int32_t delta;
+		memcpy(&delta, p + data.imm_offset, sizeof(delta));
+		return p + length + delta;
+	} //if
+
+	if (op == 0xEB)
+		return p + length + (int8_t)p[data.imm_offset];
+
+	if (op == 0xFF && data.modrm == 0x25) {
+		int32_t disp;
+		memcpy(&disp, p + data.disp_offset, sizeof(disp));
+
+		const uint8_t* slot = is64 ? p + length + disp : (const uint8_t*)(uintptr_t)(uint32_t)disp;
+		size_t width = is64 ? 8 : 4;
+
+		/* the pointer slot has to be readable as well */
+		if (hi && (slot < lo || slot > hi || (size_t)(hi - slot) < width))
+			return NULL;
+
+		uint64_t target = 0;
+		memcpy(&target, slot, width);
+		return (uint8_t*)(uintptr_t)target;
+	} //if
+
+	return NULL;
+}
+
+/* follow thunks from p, recording every hop start in chain (may be NULL) */
+static void* resolve_jmp(uint8_t* p, const uint8_t* lo, const uint8_t* hi, const ldasm_tables* tables, bool is64,
+	uint8_t** chain, size_t* chain_len)
+{
+	bool truncated = false;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	for (size_t hops = 0; hops < LDASM_MAX_JMP_HOPS; hops++) {
+		/* target is outside of the region and cannot be followed */
+		if (hi && (p < lo || p >= hi))
+			return p;
+
+		uint8_t* next = jmp_hop(p, lo, hi, tables, is64, &truncated);
+		if (truncated)
+			return NULL;
+		if (!next)
+			return p;
+
+		if (chain)
+			chain[(*chain_len)++] = p;
+		p = next;
+	}
+
+	/* exactly LDASM_MAX_JMP_HOPS hops end on p unless it jumps once more */
+	if ((hi && (p < lo || p >= hi)) || (!jmp_hop(p, lo, hi, tables, is64, &truncated) && !truncated))
+		return p;
+
+	/* cycle, or a chain longer than the hop limit */
+	return NULL;
+}
+
 void* ldasm_resolve_jmp(void* proc, const ldasm_tables* tables, bool is64)
 {
-	uint32_t  length;
-	uint8_t* opcode;
-	ldasm_insn data = { 0 };
+	if (!proc)
+		return NULL;
+
+	return resolve_jmp((uint8_t*)proc, NULL, NULL, tables, is64, NULL, NULL);
+}
 
-	length = ldasm((uint8_t*)proc, tables, &data, is64);
-	opcode = (uint8_t*)proc + data.opcd_offset;
+void* ldasm_resolve_jmp_ex(void* proc, const void* base, size_t size, const ldasm_tables* tables, bool is64)
+{
+	const uint8_t* lo = (const uint8_t*)base;
+
+	if (!proc || !lo)
+		return NULL;
+
+	return resolve_jmp((uint8_t*)proc, lo, lo + size, tables, is64, NULL, NULL);
+}
+
+bool ldasm_jmp_memo_init(ldasm_jmp_memo* memo, size_t capacity)
+{
+	if (!memo)
+		return false;
 
-	// Recursive unwind
-	if (length == 5 && data.opcd_size == 1 && *opcode == 0xE9) {
-		uint32_t delta = *(int32_t*)((uintptr_t)proc + data.opcd_size);
-		return ldasm_resolve_jmp((void*)((uintptr_t)proc + delta + length), tables, is64);
+	memset(memo, 0, sizeof(*memo));
+
+	size_t cap = 16;
+	while (cap < capacity + capacity / 2)
+		cap <<= 1;
+
+	memo->from = calloc(cap, sizeof(uintptr_t));
+	memo->to = calloc(cap, sizeof(void*));
+	if (!memo->from || !memo->to) {
+		ldasm_jmp_memo_free(memo);
+		return false;
+	} //if
+
+	memo->mask = cap - 1;
+	return true;
+}
+
+void ldasm_jmp_memo_free(ldasm_jmp_memo* memo)
+{
+	if (!memo)
+		return;
+
+	free(memo->from);
+	free(memo->to);
+	memset(memo, 0, sizeof(*memo));
+}
+
+void ldasm_jmp_memo_clear(ldasm_jmp_memo* memo)
+{
+	if (!memo || !memo->from)
+		return;
+
+	memset(memo->from, 0, (memo->mask + 1) * sizeof(uintptr_t));
+	memo->count = 0;
+}
+
+static inline size_t memo_slot(const ldasm_jmp_memo* memo, uintptr_t key)
+{
+	return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) & memo->mask;
+}
+
+void* ldasm_resolve_jmp_memo(void* proc, const void* base, size_t size, const ldasm_tables* tables, bool is64,
+	ldasm_jmp_memo* memo)
+{
+	const uint8_t* lo = (const uint8_t*)base;
+	uint8_t* chain[LDASM_MAX_JMP_HOPS];
+	size_t chain_len = 0;
+
+	if (!proc)
+		return NULL;
+
+	if (!memo || !memo->from)
+		return lo ? ldasm_resolve_jmp_ex(proc, base, size, tables, is64) : ldasm_resolve_jmp(proc, tables, is64);
+
+	/* linear probing, key 0 marks an empty slot */
+	for (size_t i = memo_slot(memo, (uintptr_t)proc); memo->from[i]; i = (i + 1) & memo->mask) {
+		if (memo->from[i] == (uintptr_t)proc)
+			return memo->to[i];
 	}
 
-	return proc;
-}
\ No newline at end of file
+	void* target = resolve_jmp((uint8_t*)proc, lo, lo ? lo + size : NULL, tables, is64, chain, &chain_len);
+	if (!target)
+		return NULL;
+
+	/* every hop of the chain resolves to the same target, procedures that are no thunk are cached too */
+	if (!chain_len)
+		chain[chain_len++] = (uint8_t*)proc;
+
+	for (size_t k = 0; k < chain_len && (memo->count + 1) * 4 <= (memo->mask + 1) * 3; k++) {
+		size_t i = memo_slot(memo, (uintptr_t)chain[k]);
+		while (memo->from[i] && memo->from[i] != (uintptr_t)chain[k])
+			i = (i + 1) & memo->mask;
+
+		if (!memo->from[i])
+			++memo->count;
+		memo->from[i] = (uintptr_t)chain[k];
+		memo->to[i] = target;
+	}
+
+	return target;
+}
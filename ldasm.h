@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct _ldasm_tables
@@ -21,8 +22,17 @@ typedef struct _ldasm_insn
 	uint8_t  flags;
 	uint8_t  modrm;
 	uint8_t  sib;
+	uint8_t  vex_offset;
+	uint8_t  vex_size;  /* VEX (C4/C5), EVEX (62) or XOP (8F) prefix size, 0 if none */
+	uint8_t  vex[3];    /* prefix bytes following the escape byte */
 } ldasm_insn;
 
+/* returned by the bounded functions when an instruction runs past the available bytes */
+#define LDASM_TRUNCATED ((size_t)-1)
+
+/* thunks followed by the jump resolvers before a chain is treated as a cycle */
+#define LDASM_MAX_JMP_HOPS 32
+
 enum ldasm_flags
 {
 	DF_INVALID = 1 << 0,
@@ -40,17 +50,190 @@ enum ldasm_flags
  */
 bool ldasm_init(ldasm_tables* tables);
 
+/**
+ * @brief Built-in tables, decompressed once on first use (thread-safe)
+ *
+ * Every function taking a tables pointer uses these when NULL is passed,
+ * so ldasm_init() is only needed by callers that keep their own copy.
+ */
+const ldasm_tables* ldasm_default_tables(void);
+
 /**
  * @brief Disassemble one instruction from code buffer
  */
 size_t ldasm(const void* code, const ldasm_tables* tables, ldasm_insn* ld, bool is64);
 
+/**
+ * @brief Disassemble one instruction, reading at most avail bytes from code
+ * @return Instruction length, or LDASM_TRUNCATED if it does not fit into avail bytes
+ */
+size_t ldasm_ex(const void* code, size_t avail, const ldasm_tables* tables, ldasm_insn* ld, bool is64);
+
+/**
+ * @brief Linear sweep: disassemble consecutive instructions from a buffer of len bytes
+ *
+ * Decodes up to cap instructions into out and their lengths into lengths (either may be NULL).
+ * Stops before an instruction that would cross the end of the buffer. The number of bytes
+ * decoded is stored in consumed (may be NULL), so the caller can resume from code + consumed.
+ *
+ * @return Number of decoded instructions
+ */
+size_t ldasm_sweep(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	ldasm_insn* out, uint8_t* lengths, size_t cap, size_t* consumed);
+
+/* output arrays of ldasm_sweep_soa(), one entry per instruction, any of them may be NULL */
+typedef struct _ldasm_soa
+{
+	uint8_t* length;
+	uint8_t* flags;
+	uint8_t* opcd_offset;
+	uint8_t* disp_offset;
+	uint8_t* disp_size;
+	uint8_t* imm_offset;
+	uint8_t* imm_size;
+} ldasm_soa;
+
+/**
+ * @brief Linear sweep into separate arrays per field, same instructions and consumed count as ldasm_sweep()
+ */
+size_t ldasm_sweep_soa(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	const ldasm_soa* out, size_t cap, size_t* consumed);
+
+/* fields of a packed instruction, flags in the low byte */
+#define LDASM_PACKED_FLAGS(v)       ((uint8_t)(v))
+#define LDASM_PACKED_LENGTH(v)      (((v) >> 8) & 0x1Fu)
+#define LDASM_PACKED_OPCD_OFFSET(v) (((v) >> 13) & 0xFu)
+#define LDASM_PACKED_DISP_OFFSET(v) (((v) >> 17) & 0xFu)
+#define LDASM_PACKED_DISP_SIZE(v)   ((1u << (((v) >> 21) & 3u)) >> 1)
+#define LDASM_PACKED_IMM_OFFSET(v)  (((v) >> 23) & 0xFu)
+#define LDASM_PACKED_IMM_SIZE(v)    (((v) >> 27) & 0xFu)
+
+/**
+ * @brief Pack an instruction into 32 bits: flags, length, opcode, displacement and immediate
+ *
+ * Offsets and sizes are kept for instructions of up to 15 bytes. Longer ones are always
+ * DF_INVALID and keep only their flags and length.
+ */
+uint32_t ldasm_pack(const ldasm_insn* ld, size_t length);
+
+/**
+ * @brief Expand a packed instruction, fields that are not packed are zeroed
+ *
+ * @return Length of the instruction
+ */
+size_t ldasm_unpack(uint32_t packed, ldasm_insn* ld);
+
+/**
+ * @brief Linear sweep into packed instructions, same instructions and consumed count as ldasm_sweep()
+ */
+size_t ldasm_sweep_packed(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	uint32_t* out, size_t cap, size_t* consumed);
+
+/**
+ * @brief Length-only linear sweep using the widest SIMD kernel supported by the CPU
+ *
+ * Produces the same lengths and consumed count as ldasm_sweep() with out == NULL.
+ */
+size_t ldasm_sweep_lengths(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	uint8_t* lengths, size_t cap, size_t* consumed);
+
+/**
+ * @brief Linear sweep split across threads (0 = one per online CPU)
+ *
+ * Chunks are decoded speculatively in parallel and reconciled at the point where the real
+ * instruction stream resynchronizes, so the result is identical to ldasm_sweep().
+ */
+size_t ldasm_sweep_parallel(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	ldasm_insn* out, uint8_t* lengths, size_t cap, size_t* consumed, unsigned threads);
+
 /**
  * @brief Calculate size of a procedure
  */
 size_t ldasm_size_of_proc(void* proc, const ldasm_tables* tables, bool is64);
 
-/** 
- * @brief Resolve the final jump target by recursively following relative jumps
+/**
+ * @brief Resolve the final jump target by following thunks (see ldasm_resolve_jmp_ex)
+ * @return Final target, or NULL if the chain is a cycle or longer than LDASM_MAX_JMP_HOPS
+ */
+void* ldasm_resolve_jmp(void* proc, const ldasm_tables* tables, bool is64);
+
+/**
+ * @brief Calculate size of a procedure, reading at most avail bytes
+ * @return Size of the procedure, or LDASM_TRUNCATED if no return was found within avail bytes
+ */
+size_t ldasm_size_of_proc_ex(const void* proc, size_t avail, const ldasm_tables* tables, bool is64);
+
+/**
+ * @brief Size a procedure by following its control flow, reading at most limit bytes
+ *
+ * Walks every path from proc with a worklist, following Jcc/JMP/LOOP targets inside
+ * [proc, proc + limit) and ending paths at ret, int3, hlt, ud2, indirect jumps, invalid
+ * instructions and branches out of the range (tail calls). Every instruction is decoded once.
+ * The number of basic blocks is stored in blocks (may be NULL).
+ *
+ * @return Extent of the procedure (end of the furthest instruction reached), LDASM_TRUNCATED if
+ * a path runs past limit, or 0 if proc is NULL or out of memory
+ */
+size_t ldasm_size_of_proc_cfg(const void* proc, size_t limit, const ldasm_tables* tables, bool is64, size_t* blocks);
+
+/**
+ * @brief Resolve the final jump target, only reading code and pointer slots inside [base, base + size)
+ *
+ * Follows E9 rel32, EB rel8 and FF 25 (jmp [rip+disp32], or jmp [disp32] in 32-bit code), also
+ * behind endbr64/endbr32 and bnd/notrack prefixes, for at most LDASM_MAX_JMP_HOPS hops.
+ *
+ * @return Final target (which may lie outside the region), or NULL if an instruction is truncated
+ * or the chain is a cycle or longer than LDASM_MAX_JMP_HOPS
+ */
+void* ldasm_resolve_jmp_ex(void* proc, const void* base, size_t size, const ldasm_tables* tables, bool is64);
+
+typedef struct _ldasm_jmp_memo
+{
+	uintptr_t* from;    /* open addressing, 0 = empty */
+	void**     to;
+	size_t     mask;
+	size_t     count;
+} ldasm_jmp_memo;
+
+/**
+ * @brief Allocate a memo table for about capacity thunk addresses
+ */
+bool ldasm_jmp_memo_init(ldasm_jmp_memo* memo, size_t capacity);
+
+/**
+ * @brief Release a memo table
+ */
+void ldasm_jmp_memo_free(ldasm_jmp_memo* memo);
+
+/**
+ * @brief Forget all resolved chains, needed after patching code that was resolved through the memo
+ */
+void ldasm_jmp_memo_clear(ldasm_jmp_memo* memo);
+
+/**
+ * @brief ldasm_resolve_jmp_ex() (or ldasm_resolve_jmp() when base is NULL) with a memo table
+ *
+ * Every hop of a walked chain is stored with its final target, so resolving any address of a
+ * known chain again is a single lookup. A full table stops caching. The memo is not thread-safe.
+ */
+void* ldasm_resolve_jmp_memo(void* proc, const void* base, size_t size, const ldasm_tables* tables, bool is64,
+	ldasm_jmp_memo* memo);
+
+/**
+ * @brief Copy whole instructions covering at least min_bytes from src to dst, fixing up relative operands
+ *
+ * dst_addr is the address the copy will run at (dst may be a writable alias of it). Short branches
+ * are widened to rel32, targets out of rel32 reach get absolute sequences, and branches into the
+ * copied range are pointed into the copy. The number of source bytes taken is stored in copied.
+ *
+ * @return Bytes written to dst, or 0 if an instruction is invalid, a target cannot be fixed up
+ * or the copy does not fit into dst_cap bytes
+ */
+size_t ldasm_relocate(const void* src, size_t min_bytes, void* dst, size_t dst_cap, uint64_t dst_addr,
+	const ldasm_tables* tables, bool is64, size_t* copied);
+
+/**
+ * @brief Write a jump from dst_addr to target (rel32, or an absolute jump when out of reach)
+ * @return Bytes written to dst (5 or 14), or 0 if dst_cap is too small
  */
-void* ldasm_resolve_jmp(void* proc, const ldasm_tables* tables, bool is64);
\ No newline at end of file
+size_t ldasm_write_jmp(void* dst, size_t dst_cap, uint64_t dst_addr, uint64_t target, bool is64);
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+
+#include "ldasm_arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Near-address executable arena.
+//
+// Regions are reserved inside rel32 reach of the address a slot is asked for, found from the
+// gaps in /proc/self/maps (or by probing when it cannot be read). Each region hands out
+// fixed-size slots: first from its free list of released slots, then from the never used tail.
+// The bookkeeping lives on the heap, so releasing a slot never needs executable memory to be
+// writable.
+//
+// A region is a memfd mapped twice: read+execute near the target, where the slots run, and
+// read+write anywhere, where they are written. No view is ever both, and neither changes
+// protection, so slots are reused while other slots of the region run. Where memfd_create() is
+// not available a region is one anonymous mapping that is either writable or executable:
+// ldasm_arena_protect() flips all of them to executable in one pass, after which the region is
+// sealed, other threads may be running its slots, so it hands out no slot again.
+
+#define DEFAULT_SLOT_SIZE   64
+#define DEFAULT_REGION_SIZE (64 * 1024)
+#define NEAR_MARGIN         (16ull << 20)
+#define REACH               ((1ull << 31) - NEAR_MARGIN)
+#define MAX_PROBES          1024
+#define USER_TOP            0x00007FFFFFFFF000ull
+
+struct _ldasm_arena_region
+{
+	ldasm_arena_region* next;
+	uint8_t*            base;        /* slots run here */
+	uint8_t*            alias;       /* and are written here, base itself if not dual-mapped */
+	size_t              slots;       /* capacity */
+	size_t              carved;      /* slots below this index were handed out at least once */
+	size_t              used;
+	uint32_t*           free;        /* stack of released slot indices */
+	size_t              free_count;
+	bool                writable;
+	bool                sealed;      /* single mapping that was executable, never handed out from again */
+};
+
+/* every byte of [start, start + size) is within reach of near */
+static bool in_reach(uint64_t near, uint64_t start, size_t size)
+{
+	int64_t lo = (int64_t)(start - near);
+	int64_t hi = (int64_t)(start + size - near);
+	return lo > -(int64_t)REACH && hi < (int64_t)REACH;
+}
+
+/* the executable view of fd, or a writable anonymous mapping if fd < 0 */
+static uint8_t* try_map(uint64_t addr, size_t size, uint64_t near, int fd)
+{
+	int flags = fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS;
+	int prot = fd >= 0 ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE;
+#ifdef MAP_FIXED_NOREPLACE
+	if (addr)
+		flags |= MAP_FIXED_NOREPLACE;
+#endif
+
+	uint8_t* p = mmap((void*)(uintptr_t)addr, size, prot, flags, fd, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	/* without MAP_FIXED_NOREPLACE the hint may be ignored */
+	if (near && !in_reach(near, (uint64_t)(uintptr_t)p, size)) {
+		munmap(p, size);
+		return NULL;
+	} //if
+
+	return p;
+}
+
+/* address in the gap [from, to) closest to near, 0 if the region does not fit in reach */
+static uint64_t gap_candidate(uint64_t from, uint64_t to, size_t size, uint64_t near)
+{
+	from = (from + size - 1) / size * size;
+	if (to < size || from > to - size)
+		return 0;
+
+	uint64_t at = near / size * size;
+	if (at < from)
+		at = from;
+	if (at > to - size)
+		at = (to - size) / size * size;
+
+	return at >= from && in_reach(near, at, size) ? at : 0;
+}
+
+/* the free gap closest to near, from /proc/self/maps */
+static uint64_t find_gap(size_t size, uint64_t near)
+{
+	FILE* f = fopen("/proc/self/maps", "r");
+	if (!f)
+		return 0;
+
+	char line[512];
+	uint64_t prev = (uint64_t)sysconf(_SC_PAGESIZE) << 4, best = 0, best_dist = UINT64_MAX;
+
+	for (bool more = true; more;) {
+		unsigned long long start = USER_TOP, end = USER_TOP;
+
+		more = fgets(line, sizeof(line), f) != NULL;
+		if (more && sscanf(line, "%llx-%llx", &start, &end) != 2)
+			continue;
+
+		uint64_t at = start > prev ? gap_candidate(prev, start, size, near) : 0;
+		if (at) {
+			uint64_t dist = at > near ? at - near : near - at;
+			if (dist < best_dist) {
+				best = at;
+				best_dist = dist;
+			} //if
+		} //if
+
+		if (end > prev)
+			prev = end;
+	}
+
+	fclose(f);
+	return best;
+}
+
+static uint8_t* map_near(size_t size, uint64_t near, int fd)
+{
+	if (!near)
+		return try_map(0, size, 0, fd);
+
+	uint64_t at = find_gap(size, near);
+	uint8_t* p = at ? try_map(at, size, near, fd) : NULL;
+
+	/* probe outwards from near when the gap is gone or the map could not be read */
+	for (size_t i = 1; !p && i <= MAX_PROBES; i++) {
+		uint64_t step = (uint64_t)i * (REACH / MAX_PROBES) / size * size;
+		uint64_t base = near / size * size;
+
+		if (base + step < USER_TOP)
+			p = try_map(base + step, size, near, fd);
+		if (!p && base > step)
+			p = try_map(base - step, size, near, fd);
+	}
+
+	return p;
+}
+
+/* a memfd of the region size and its writable view, -1 if the kernel has none */
+static int map_alias(size_t size, uint8_t** alias)
+{
+	*alias = NULL;
+#ifdef MFD_CLOEXEC
+	int fd = memfd_create("ldasm-arena", MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	void* p = ftruncate(fd, (off_t)size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (p == MAP_FAILED) {
+		close(fd);
+		return -1;
+	} //if
+
+	*alias = p;
+	return fd;
+#else
+	(void)size;
+	return -1;
+#endif
+}
+
+static ldasm_arena_region* add_region(ldasm_arena* arena, uint64_t near)
+{
+	uint8_t* alias = NULL;
+	ldasm_arena_region* r = calloc(1, sizeof(ldasm_arena_region));
+	if (!r)
+		return NULL;
+
+	r->slots = arena->region_size / arena->slot_size;
+	r->free = malloc(r->slots * sizeof(uint32_t));
+
+	int fd = r->free ? map_alias(arena->region_size, &alias) : -1;
+	r->base = r->free ? map_near(arena->region_size, near, fd) : NULL;
+
+	/* memfds may not be mapped executable here, fall back to a single mapping */
+	if (fd >= 0 && !r->base) {
+		munmap(alias, arena->region_size);
+		alias = NULL;
+		r->base = map_near(arena->region_size, near, -1);
+	} //if
+
+	if (fd >= 0)
+		close(fd);
+
+	if (!r->base) {
+		free(r->free);
+		free(r);
+		return NULL;
+	} //if
+
+	r->alias = alias ? alias : r->base;
+	r->writable = !alias;
+
+	/* never executed, but trap if jumped into */
+	memset(r->alias, 0xCC, arena->region_size);
+
+	r->next = arena->regions;
+	arena->regions = r;
+	++arena->region_count;
+	++arena->maps;
+	return r;
+}
+
+static ldasm_arena_region* find_region(ldasm_arena* arena, const void* slot, ldasm_arena_region*** link)
+{
+	const uint8_t* p = (const uint8_t*)slot;
+	ldasm_arena_region** prev = &arena->regions;
+
+	for (ldasm_arena_region* r = arena->regions; r; prev = &r->next, r = r->next) {
+		if (p >= r->base && p < r->base + arena->region_size) {
+			if (link)
+				*link = prev;
+			return r;
+		} //if
+	}
+
+	return NULL;
+}
+
+static void unmap_region(ldasm_arena* arena, ldasm_arena_region* r)
+{
+	if (r->alias != r->base)
+		munmap(r->alias, arena->region_size);
+	munmap(r->base, arena->region_size);
+	free(r->free);
+	free(r);
+}
+
+static bool set_writable(ldasm_arena* arena, ldasm_arena_region* r, bool writable)
+{
+	/* a dual-mapped region is always written through its alias */
+	if (r->alias != r->base || r->writable == writable)
+		return true;
+
+	int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+	if (mprotect(r->base, arena->region_size, prot) != 0)
+		return false;
+
+	r->writable = writable;
+	r->sealed |= !writable;
+	return true;
+}
+
+bool ldasm_arena_init(ldasm_arena* arena, size_t slot_size, size_t region_size)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	if (!arena)
+		return false;
+
+	memset(arena, 0, sizeof(*arena));
+
+	slot_size = slot_size ? (slot_size + 15) & ~(size_t)15 : DEFAULT_SLOT_SIZE;
+	region_size = region_size ? region_size : DEFAULT_REGION_SIZE;
+	region_size = (region_size + page - 1) / page * page;
+
+	if (slot_size > region_size || region_size / slot_size > UINT32_MAX)
+		return false;
+
+	arena->slot_size = slot_size;
+	arena->region_size = region_size;
+	return pthread_mutex_init(&arena->lock, NULL) == 0;
+}
+
+void ldasm_arena_destroy(ldasm_arena* arena)
+{
+	if (!arena)
+		return;
+
+	for (ldasm_arena_region* r = arena->regions, *next; r; r = next) {
+		next = r->next;
+		unmap_region(arena, r);
+	}
+
+	pthread_mutex_destroy(&arena->lock);
+	memset(arena, 0, sizeof(*arena));
+}
+
+void* ldasm_arena_alloc(ldasm_arena* arena, const void* near)
+{
+	const uint64_t target = (uint64_t)(uintptr_t)near;
+	ldasm_arena_region* r;
+	uint8_t* slot = NULL;
+
+	if (!arena)
+		return NULL;
+
+	pthread_mutex_lock(&arena->lock);
+
+	for (r = arena->regions; r; r = r->next) {
+		if (!r->sealed && r->used < r->slots && (!target || in_reach(target, (uint64_t)(uintptr_t)r->base, arena->region_size)))
+			break;
+	}
+
+	if (!r)
+		r = add_region(arena, target);
+
+	if (r) {
+		size_t index = r->free_count ? r->free[--r->free_count] : r->carved++;
+		slot = r->base + index * arena->slot_size;
+		++r->used;
+	} //if
+
+	pthread_mutex_unlock(&arena->lock);
+	return slot;
+}
+
+void ldasm_arena_free(ldasm_arena* arena, void* slot)
+{
+	ldasm_arena_region** link;
+
+	if (!arena || !slot)
+		return;
+
+	pthread_mutex_lock(&arena->lock);
+
+	ldasm_arena_region* r = find_region(arena, slot, &link);
+	if (r) {
+		size_t index = (size_t)((uint8_t*)slot - r->base) / arena->slot_size;
+
+		if (--r->used == 0) {
+			*link = r->next;
+			--arena->region_count;
+			unmap_region(arena, r);
+		}
+		else if (!r->sealed) {
+			/* fill a released slot with int3 while it can be written */
+			memset(r->alias + index * arena->slot_size, 0xCC, arena->slot_size);
+			r->free[r->free_count++] = (uint32_t)index;
+		} //if
+	} //if
+
+	pthread_mutex_unlock(&arena->lock);
+}
+
+void* ldasm_arena_writable(ldasm_arena* arena, void* slot)
+{
+	uint8_t* p = NULL;
+
+	if (!arena || !slot)
+		return NULL;
+
+	pthread_mutex_lock(&arena->lock);
+
+	ldasm_arena_region* r = find_region(arena, slot, NULL);
+	if (r)
+		p = r->alias + ((uint8_t*)slot - r->base);
+
+	pthread_mutex_unlock(&arena->lock);
+	return p;
+}
+
+bool ldasm_arena_protect(ldasm_arena* arena)
+{
+	bool ok = true;
+
+	if (!arena)
+		return false;
+
+	pthread_mutex_lock(&arena->lock);
+
+	for (ldasm_arena_region* r = arena->regions; r; r = r->next)
+		ok &= set_writable(arena, r, false);
+
+	pthread_mutex_unlock(&arena->lock);
+	return ok;
+}
+
+bool ldasm_arena_unprotect(ldasm_arena* arena, void* slot)
+{
+	bool ok = false;
+
+	if (!arena || !slot)
+		return false;
+
+	pthread_mutex_lock(&arena->lock);
+
+	ldasm_arena_region* r = find_region(arena, slot, NULL);
+	if (r)
+		ok = set_writable(arena, r, true);
+
+	pthread_mutex_unlock(&arena->lock);
+	return ok;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ldasm.h"
+
+#include <pthread.h>
+
+typedef struct _ldasm_arena_region ldasm_arena_region;
+
+typedef struct _ldasm_arena
+{
+	ldasm_arena_region* regions;        /* reserved regions, each with its own free list */
+	size_t              region_count;
+	size_t              slot_size;
+	size_t              region_size;
+	size_t              maps;           /* mmap calls that reserved a region */
+	pthread_mutex_t     lock;
+} ldasm_arena;
+
+/**
+ * @brief Initialize an arena of fixed-size executable slots (0 = 64 byte slots, 64 KB regions)
+ *
+ * All calls may be made from any thread. Regions are memfds mapped read+execute near their target
+ * and read+write elsewhere, so slots are written through ldasm_arena_writable() while other slots
+ * run, and are reused as soon as they are freed. Where memfds cannot be mapped executable, a region
+ * is a single mapping toggled by ldasm_arena_protect() and ldasm_arena_unprotect(), and is never
+ * handed out from once it was executable.
+ */
+bool ldasm_arena_init(ldasm_arena* arena, size_t slot_size, size_t region_size);
+
+/**
+ * @brief Unmap every region, all slots become invalid
+ */
+void ldasm_arena_destroy(ldasm_arena* arena);
+
+/**
+ * @brief Take a slot within rel32 reach of near (NULL = anywhere)
+ *
+ * Code within 16 MB of near can reach the slot, and the slot can reach it back, with rel32.
+ * Allocating never changes the protection of a region, so it never takes execute rights from
+ * live slots.
+ *
+ * @return Address the slot runs at, or NULL if no region could be reserved within reach
+ */
+void* ldasm_arena_alloc(ldasm_arena* arena, const void* near);
+
+/**
+ * @brief Return a slot to the free list of its region, the region is unmapped once it is empty
+ *
+ * The slot is filled with int3 and may be handed out by the next allocation, so no thread may
+ * still be running it. Slots of a single-mapped region that was executable are not reused.
+ */
+void ldasm_arena_free(ldasm_arena* arena, void* slot);
+
+/**
+ * @brief Address to write a slot through, code in it must be built for the slot address itself
+ *
+ * Writing a slot that another thread may be running is up to the caller to avoid.
+ *
+ * @return Writable alias of the slot, the slot itself for a single-mapped region, NULL if unknown
+ */
+void* ldasm_arena_writable(ldasm_arena* arena, void* slot);
+
+/**
+ * @brief Make every single-mapped region read+execute, one mprotect per region
+ *
+ * Call before running slots; dual-mapped regions are executable from the start.
+ */
+bool ldasm_arena_protect(ldasm_arena* arena);
+
+/**
+ * @brief Make the region of a slot writable again until the next ldasm_arena_protect()
+ *
+ * Nothing to do for a dual-mapped region. A single-mapped region loses execute rights for every
+ * slot: threads running any of them fault until it is protected again, so only use it while none
+ * of them can be entered.
+ */
+bool ldasm_arena_unprotect(ldasm_arena* arena, void* slot);
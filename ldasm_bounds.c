@@ -0,0 +1,253 @@
+#include "ldasm_bounds.h"
+#include "ldasm_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Instruction boundary index.
+//
+// One bit per code byte marks where the instructions of a linear sweep start, taken from the
+// speculative parallel sweep, whose reconciled bitmap is exactly that. A rank directory holds the
+// number of starts before every block of 512 bits, so a rank is the directory entry plus at most
+// eight popcounts. Select samples every 512th instruction's block: no instruction is longer than
+// 15 bytes, so the instruction searched for lies at most 15 blocks past its sample.
+//
+// A patch only disturbs the stream until it lines up with an old instruction start again, from
+// there on the unchanged bytes decode as before. Patching decodes that stretch once to measure it,
+// so a failed allocation leaves the index as it was, then rewrites its bits.
+
+#define BLOCK_WORDS (LDASM_BOUNDS_BLOCK / 64)
+
+static inline bool test_bit(const uint64_t* bits, size_t i)
+{
+	return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+/* samples of the instructions from index first on, the blocks before from_block are unchanged */
+static void fill_samples(ldasm_bounds* bounds, size_t first, size_t from_block, size_t last)
+{
+	size_t blocks = (bounds->size + LDASM_BOUNDS_BLOCK - 1) / LDASM_BOUNDS_BLOCK;
+	size_t samples = (bounds->count + LDASM_BOUNDS_SAMPLE - 1) / LDASM_BOUNDS_SAMPLE;
+	size_t k = (first + LDASM_BOUNDS_SAMPLE - 1) / LDASM_BOUNDS_SAMPLE;
+
+	for (size_t b = from_block; b < blocks && k < samples && k * LDASM_BOUNDS_SAMPLE < last; b++) {
+		while (k < samples && k * LDASM_BOUNDS_SAMPLE < bounds->ranks[b + 1])
+			bounds->samples[k++] = (uint32_t)b;
+	}
+}
+
+bool ldasm_bounds_build(ldasm_bounds* bounds, const void* code, size_t len, uint64_t addr,
+	const ldasm_tables* tables, bool is64, unsigned threads)
+{
+	if (!bounds || !code)
+		return false;
+
+	memset(bounds, 0, sizeof(*bounds));
+
+	size_t words = (len + 63) / 64;
+	size_t blocks = (words + BLOCK_WORDS - 1) / BLOCK_WORDS;
+
+	/* padded to whole blocks so ranks never look at a partial one */
+	bounds->bits = calloc(blocks * BLOCK_WORDS + 1, sizeof(uint64_t));
+	bounds->ranks = malloc((blocks + 1) * sizeof(uint64_t));
+	if (!bounds->bits || !bounds->ranks) {
+		ldasm_bounds_free(bounds);
+		return false;
+	} //if
+
+	bounds->addr = addr;
+	bounds->size = len;
+	bounds->count = ldasm_sweep_boundaries(code, len, tables, is64, bounds->bits, threads, NULL);
+
+	uint64_t rank = 0;
+	for (size_t b = 0; b < blocks; b++) {
+		bounds->ranks[b] = rank;
+		for (size_t w = b * BLOCK_WORDS; w < (b + 1) * BLOCK_WORDS; w++)
+			rank += ldasm_popcount64(bounds->bits[w]);
+	}
+	bounds->ranks[blocks] = rank;
+
+	size_t samples = (bounds->count + LDASM_BOUNDS_SAMPLE - 1) / LDASM_BOUNDS_SAMPLE;
+	bounds->samples = malloc((samples ? samples : 1) * sizeof(uint32_t));
+	if (!bounds->samples || blocks > UINT32_MAX) {
+		ldasm_bounds_free(bounds);
+		return false;
+	} //if
+
+	fill_samples(bounds, 0, 0, SIZE_MAX);
+
+	return true;
+}
+
+bool ldasm_bounds_is_start(const ldasm_bounds* bounds, uint64_t address)
+{
+	if (!bounds || !bounds->bits || address < bounds->addr || address - bounds->addr >= bounds->size)
+		return false;
+
+	uint64_t off = address - bounds->addr;
+	return (bounds->bits[off >> 6] >> (off & 63)) & 1;
+}
+
+size_t ldasm_bounds_rank(const ldasm_bounds* bounds, uint64_t address)
+{
+	if (!bounds || !bounds->bits || address < bounds->addr)
+		return 0;
+	if (address - bounds->addr >= bounds->size)
+		return bounds->count;
+
+	uint64_t off = address - bounds->addr;
+	size_t word = (size_t)(off >> 6);
+	size_t rank = (size_t)bounds->ranks[word / BLOCK_WORDS];
+
+	for (size_t w = word & ~(size_t)(BLOCK_WORDS - 1); w < word; w++)
+		rank += ldasm_popcount64(bounds->bits[w]);
+
+	return rank + ldasm_popcount64(bounds->bits[word] & ((1ull << (off & 63)) - 1));
+}
+
+bool ldasm_bounds_select(const ldasm_bounds* bounds, size_t index, uint64_t* address)
+{
+	if (!bounds || !bounds->bits || index >= bounds->count)
+		return false;
+
+	size_t block = bounds->samples[index / LDASM_BOUNDS_SAMPLE];
+	while (bounds->ranks[block + 1] <= index)
+		++block;
+
+	size_t rest = index - (size_t)bounds->ranks[block];
+	size_t word = block * BLOCK_WORDS;
+	for (;; word++) {
+		unsigned n = ldasm_popcount64(bounds->bits[word]);
+		if (rest < n)
+			break;
+		rest -= n;
+	}
+
+	uint64_t bits = bounds->bits[word];
+	while (rest--)
+		bits &= bits - 1;
+
+	if (address)
+		*address = bounds->addr + word * 64 + ldasm_ctz64(bits);
+
+	return true;
+}
+
+bool ldasm_bounds_floor(const ldasm_bounds* bounds, uint64_t address, uint64_t* start)
+{
+	if (!bounds || !bounds->bits || address < bounds->addr)
+		return false;
+
+	/* starts at or before address */
+	size_t rank = address - bounds->addr >= bounds->size ? bounds->count : ldasm_bounds_rank(bounds, address + 1);
+
+	return rank && ldasm_bounds_select(bounds, rank - 1, start);
+}
+
+bool ldasm_bounds_patch(ldasm_bounds* bounds, const void* code, uint64_t address, size_t size,
+	const ldasm_tables* tables, bool is64, ldasm_insn* out, uint8_t* lengths, size_t cap, ldasm_bounds_delta* delta)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	uint64_t start;
+	ldasm_insn ld;
+
+	if (!bounds || !bounds->bits || !p || address < bounds->addr || address - bounds->addr >= bounds->size)
+		return false;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	size_t patch_end = address - bounds->addr + size;
+	if (patch_end > bounds->size || patch_end < size)
+		patch_end = bounds->size;
+
+	size_t from = ldasm_bounds_floor(bounds, address, &start) ? (size_t)(start - bounds->addr) : 0;
+	size_t first = ldasm_bounds_rank(bounds, bounds->addr + from);
+	size_t pos = from, count = 0, n;
+
+	/* measure the stretch up to where the new stream lines up with an old start */
+	while (pos < bounds->size && (pos < patch_end || !test_bit(bounds->bits, pos))) {
+		n = ldasm_ex(p + pos, bounds->size - pos, tables, out && count < cap ? &out[count] : &ld, is64);
+		if (n == LDASM_TRUNCATED) {
+			/* the stream now ends in a cut-off instruction, drop the old starts after it */
+			pos = bounds->size;
+			break;
+		} //if
+
+		if (lengths && count < cap)
+			lengths[count] = (uint8_t)n;
+		++count;
+		pos += n;
+	}
+
+	size_t end = pos < bounds->size ? pos : bounds->size;
+	size_t old_count = ldasm_bounds_rank(bounds, bounds->addr + end) - first;
+	size_t new_total = bounds->count - old_count + count;
+
+	if (new_total > bounds->count) {
+		size_t samples = (new_total + LDASM_BOUNDS_SAMPLE - 1) / LDASM_BOUNDS_SAMPLE;
+		uint32_t* grown = realloc(bounds->samples, samples * sizeof(uint32_t));
+		if (!grown)
+			return false;
+		bounds->samples = grown;
+	} //if
+
+	/* rewrite the bits of the stretch */
+	for (size_t i = from; i < end; i++)
+		bounds->bits[i >> 6] &= ~(1ull << (i & 63));
+	for (pos = from; pos < end; pos += n) {
+		n = ldasm_ex(p + pos, bounds->size - pos, tables, &ld, is64);
+		if (n == LDASM_TRUNCATED)
+			break;
+		bounds->bits[pos >> 6] |= 1ull << (pos & 63);
+	}
+
+	/* ranks of the blocks inside the stretch are recounted, the ones after it shift */
+	size_t blocks = (bounds->size + LDASM_BOUNDS_BLOCK - 1) / LDASM_BOUNDS_BLOCK;
+	size_t b = from / LDASM_BOUNDS_BLOCK + 1;
+
+	for (; b <= blocks && (b - 1) * LDASM_BOUNDS_BLOCK < end; b++) {
+		uint64_t rank = bounds->ranks[b - 1];
+		for (size_t w = (b - 1) * BLOCK_WORDS; w < b * BLOCK_WORDS; w++)
+			rank += ldasm_popcount64(bounds->bits[w]);
+		bounds->ranks[b] = rank;
+	}
+
+	if (count != old_count) {
+		for (; b <= blocks; b++)
+			bounds->ranks[b] = bounds->ranks[b] - old_count + count;
+	} //if
+
+	bounds->count = new_total;
+	fill_samples(bounds, first, from / LDASM_BOUNDS_BLOCK, count != old_count ? SIZE_MAX : first + count);
+
+	if (delta) {
+		*delta = (ldasm_bounds_delta){ .start = bounds->addr + from, .end = bounds->addr + end, .first = first,
+			.old_count = old_count, .new_count = count };
+	} //if
+
+	return true;
+}
+
+size_t ldasm_bounds_bytes(const ldasm_bounds* bounds)
+{
+	if (!bounds || !bounds->bits)
+		return 0;
+
+	size_t blocks = (bounds->size + LDASM_BOUNDS_BLOCK - 1) / LDASM_BOUNDS_BLOCK;
+	size_t samples = (bounds->count + LDASM_BOUNDS_SAMPLE - 1) / LDASM_BOUNDS_SAMPLE;
+
+	return (blocks * BLOCK_WORDS + 1) * sizeof(uint64_t) + (blocks + 1) * sizeof(uint64_t)
+		+ (samples ? samples : 1) * sizeof(uint32_t);
+}
+
+void ldasm_bounds_free(ldasm_bounds* bounds)
+{
+	if (!bounds)
+		return;
+
+	free(bounds->bits);
+	free(bounds->ranks);
+	free(bounds->samples);
+	memset(bounds, 0, sizeof(*bounds));
+}
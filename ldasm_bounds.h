@@ -0,0 +1,82 @@
+#pragma once
+
+#include "ldasm.h"
+
+typedef struct _ldasm_bounds
+{
+	uint64_t  addr;         /* address of the first code byte */
+	size_t    size;         /* code bytes covered, one bit each */
+	size_t    count;        /* instructions */
+	uint64_t* bits;         /* set where an instruction starts */
+	uint64_t* ranks;        /* instructions before each block of LDASM_BOUNDS_BLOCK bits */
+	uint32_t* samples;      /* block holding every LDASM_BOUNDS_SAMPLE-th instruction */
+} ldasm_bounds;
+
+#define LDASM_BOUNDS_BLOCK  512
+#define LDASM_BOUNDS_SAMPLE 512
+
+/* what ldasm_bounds_patch() changed: instructions [first, first + old_count) became new_count others */
+typedef struct _ldasm_bounds_delta
+{
+	uint64_t start;         /* first re-decoded instruction, the one holding the first patched byte */
+	uint64_t end;           /* where the new stream lines up with the old one again */
+	size_t   first;         /* index of the first replaced instruction */
+	size_t   old_count;
+	size_t   new_count;
+} ldasm_bounds_delta;
+
+/**
+ * @brief Index the instruction starts of a linear sweep over a code region loaded at addr
+ *
+ * The sweep is split across threads (0 = one per online CPU) like ldasm_sweep_parallel(), and
+ * independent regions, such as the sections of a module, may be built concurrently. The index
+ * takes a little over 1/8 of the code size.
+ */
+bool ldasm_bounds_build(ldasm_bounds* bounds, const void* code, size_t len, uint64_t addr,
+	const ldasm_tables* tables, bool is64, unsigned threads);
+
+/**
+ * @brief Does an instruction start at address
+ */
+bool ldasm_bounds_is_start(const ldasm_bounds* bounds, uint64_t address);
+
+/**
+ * @brief Number of instructions starting before address, i.e. the index of the one at address
+ */
+size_t ldasm_bounds_rank(const ldasm_bounds* bounds, uint64_t address);
+
+/**
+ * @brief Address of the instruction with the given index
+ * @return false if index >= count
+ */
+bool ldasm_bounds_select(const ldasm_bounds* bounds, size_t index, uint64_t* address);
+
+/**
+ * @brief Start of the instruction at or before address, the one containing it if address is inside the region
+ * @return false if no instruction starts at or before address
+ */
+bool ldasm_bounds_floor(const ldasm_bounds* bounds, uint64_t address, uint64_t* start);
+
+/**
+ * @brief Update the index after size bytes at address were patched, code is the patched region
+ *
+ * Decodes from the instruction holding the first patched byte until the new stream meets an old
+ * instruction start past the patch. The new instructions are stored into out and lengths (either
+ * may be NULL, up to cap). Decoding is proportional to the patch, and so are the index updates
+ * unless the instruction count changes, then the later rank entries shift in one pass over 1/64
+ * of the code size.
+ *
+ * @return false if address is outside the region or memory ran out, the index is unchanged then
+ */
+bool ldasm_bounds_patch(ldasm_bounds* bounds, const void* code, uint64_t address, size_t size,
+	const ldasm_tables* tables, bool is64, ldasm_insn* out, uint8_t* lengths, size_t cap, ldasm_bounds_delta* delta);
+
+/**
+ * @brief Memory taken by the index
+ */
+size_t ldasm_bounds_bytes(const ldasm_bounds* bounds);
+
+/**
+ * @brief Release the index
+ */
+void ldasm_bounds_free(ldasm_bounds* bounds);
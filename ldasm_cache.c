@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+
+#include "ldasm_cache.h"
+#include "ldasm_internal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Address-keyed decode cache.
+//
+// Open addressing over buckets of LDASM_CACHE_WAYS slots: an address maps to one bucket and
+// may sit in any of its slots. Each 16 bytes of code share a bucket, with the higher address
+// bits folded in, so walking code walks the table in order instead of missing on every lookup.
+// A slot holds the address next to the 16 byte decode result and a bucket fills exactly three
+// cache lines. Slots are filled front to back and a full bucket evicts round-robin. Lookups
+// never stop at an empty slot, so invalidation just clears slots.
+//
+// The shared cache uses the same mapping. Every slot is a seqlock: a writer claims it by moving
+// the sequence from even to odd with a CAS, and a reader takes the slot only if it saw the same
+// even sequence before and after copying it. Neither side ever waits, a busy slot is just a miss
+// or a skipped insert. Each bucket also carries a generation. A slot remembers the generation its
+// decode started under and only counts while the bucket is still in it, so invalidation retires a
+// range by bumping the generation of its buckets. A decode that read the old bytes started under
+// the old generation and can never be served.
+//
+// Hit and miss counters are striped by thread. A thread owns a stripe while it lives and counts
+// with a plain load and store; the stripe goes back to the pool when the thread exits. Threads
+// beyond the STRIPES alive at once share one more stripe and count on it with atomic adds.
+
+#define MIN_BUCKETS 16
+
+static inline ldasm_cache_entry* bucket_of(const ldasm_cache* cache, uintptr_t address)
+{
+	size_t bucket = (size_t)((address >> 4) ^ (address >> cache->shift)) & cache->bucket_mask;
+	return cache->entries + bucket * LDASM_CACHE_WAYS;
+}
+
+bool ldasm_cache_init(ldasm_cache* cache, size_t capacity, const ldasm_tables* tables, bool is64)
+{
+	if (!cache)
+		return false;
+
+	memset(cache, 0, sizeof(*cache));
+
+	size_t buckets = MIN_BUCKETS;
+	unsigned bits = 4;
+	while (buckets * LDASM_CACHE_WAYS < capacity) {
+		buckets <<= 1;
+		++bits;
+	}
+
+	/* buckets start on a cache line */
+	size_t bytes = buckets * LDASM_CACHE_WAYS * sizeof(ldasm_cache_entry);
+	cache->entries = aligned_alloc(64, (bytes + 63) & ~(size_t)63);
+	if (!cache->entries)
+		return false;
+
+	memset(cache->entries, 0, bytes);
+	cache->bucket_mask = buckets - 1;
+	cache->shift = 4 + bits;
+	cache->tables = tables ? tables : ldasm_default_tables();
+	cache->is64 = is64;
+	return cache->tables != NULL;
+}
+
+void ldasm_cache_free(ldasm_cache* cache)
+{
+	if (!cache)
+		return;
+
+	free(cache->entries);
+	memset(cache, 0, sizeof(*cache));
+}
+
+size_t ldasm_cache_decode(ldasm_cache* cache, const void* code, ldasm_insn* ld)
+{
+	const uintptr_t address = (uintptr_t)code;
+
+	if (!cache || !cache->entries || !code || !ld)
+		return 0;
+
+	ldasm_cache_entry* bucket = bucket_of(cache, address);
+	ldasm_cache_entry* slot = NULL;
+
+	for (size_t i = 0; i < LDASM_CACHE_WAYS; i++) {
+		if (bucket[i].address == address) {
+			*ld = bucket[i].ld;
+			++cache->hits;
+			return bucket[i].length;
+		} //if
+		if (!bucket[i].address && !slot)
+			slot = &bucket[i];
+	}
+
+	++cache->misses;
+
+	size_t length = ldasm(code, cache->tables, ld, cache->is64);
+
+	if (!slot) {
+		slot = &bucket[cache->clock++ % LDASM_CACHE_WAYS];
+		++cache->evictions;
+	} //if
+
+	slot->address = address;
+	slot->ld = *ld;
+	slot->length = (uint8_t)length;
+	return length;
+}
+
+static void drop_overlapping(ldasm_cache_entry* e, size_t count, uintptr_t lo, uintptr_t hi)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (e[i].address && e[i].address < hi && e[i].address + e[i].length > lo)
+			e[i].address = 0;
+	}
+}
+
+void ldasm_cache_invalidate(ldasm_cache* cache, const void* code, size_t size)
+{
+	const uintptr_t lo = (uintptr_t)code;
+	const uintptr_t hi = lo + size;
+
+	if (!cache || !cache->entries || !size)
+		return;
+
+	/* instructions starting up to 15 bytes before the range may overlap it */
+	uintptr_t first = (lo < 15 ? 0 : lo - 15) >> 4;
+	uintptr_t last = (hi - 1) >> 4;
+	size_t buckets = cache->bucket_mask + 1;
+
+	/* each 16 byte block lives in one bucket, ranges spanning more blocks than buckets scan them all */
+	if (last - first >= buckets) {
+		drop_overlapping(cache->entries, buckets * LDASM_CACHE_WAYS, lo, hi);
+		return;
+	} //if
+
+	for (uintptr_t block = first; block <= last; block++)
+		drop_overlapping(bucket_of(cache, block << 4), LDASM_CACHE_WAYS, lo, hi);
+}
+
+void ldasm_cache_clear(ldasm_cache* cache)
+{
+	if (!cache || !cache->entries)
+		return;
+
+	memset(cache->entries, 0, (cache->bucket_mask + 1) * LDASM_CACHE_WAYS * sizeof(ldasm_cache_entry));
+	cache->hits = cache->misses = cache->evictions = 0;
+}
+
+#define SHARED_WAYS 7
+#define STRIPES     64
+
+typedef struct _shared_slot
+{
+	_Atomic uint32_t  seq;          /* odd while a writer owns the slot */
+	_Atomic uint32_t  gen;
+	_Atomic uintptr_t address;
+	_Atomic uint64_t  value[2];     /* ldasm_insn, then the length in the last byte */
+} shared_slot;
+
+struct _ldasm_shared_cache_bucket
+{
+	_Alignas(64) _Atomic uint32_t gen;
+	_Atomic uint32_t              clock;
+	shared_slot                   slots[SHARED_WAYS];
+};
+
+struct _ldasm_shared_cache_stripe
+{
+	_Alignas(64) _Atomic uint64_t hits;
+	_Atomic uint64_t              misses;
+	_Atomic uint64_t              evictions;
+	_Atomic uint64_t              contended;
+};
+
+_Static_assert(sizeof(ldasm_insn) <= 15, "a shared slot keeps the length in the last of its 16 value bytes");
+_Static_assert(STRIPES == 64, "free stripes are one bit each in a uint64_t");
+
+static _Atomic uint64_t free_stripes = UINT64_MAX;
+static pthread_key_t stripe_key;
+static pthread_once_t stripe_once = PTHREAD_ONCE_INIT;
+static _Thread_local unsigned thread_stripe;
+static _Thread_local bool thread_shared;
+
+/* give the stripe of an exiting thread back */
+static void release_stripe(void* stripe)
+{
+	atomic_fetch_or_explicit(&free_stripes, 1ull << ((uintptr_t)stripe - 1), memory_order_release);
+}
+
+static void create_stripe_key(void)
+{
+	pthread_key_create(&stripe_key, release_stripe);
+}
+
+static ldasm_shared_cache_stripe* stripe_of(const ldasm_shared_cache* cache)
+{
+	if (!thread_stripe) {
+		uint64_t free = atomic_load_explicit(&free_stripes, memory_order_relaxed);
+
+		pthread_once(&stripe_once, create_stripe_key);
+
+		/* acquire pairs with the release of the previous owner's counts */
+		while (free && !atomic_compare_exchange_weak_explicit(&free_stripes, &free, free & (free - 1),
+			memory_order_acquire, memory_order_relaxed))
+			;
+
+		if (free && pthread_setspecific(stripe_key, (void*)(uintptr_t)(ldasm_ctz64(free) + 1)) == 0) {
+			thread_stripe = ldasm_ctz64(free) + 1;
+		}
+		else {
+			if (free)
+				release_stripe((void*)(uintptr_t)(ldasm_ctz64(free) + 1));
+			thread_stripe = STRIPES + 1;
+			thread_shared = true;
+		} //if
+	} //if
+
+	return &cache->stripes[thread_stripe - 1];
+}
+
+static inline void count(_Atomic uint64_t* counter)
+{
+	if (thread_shared)
+		atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+	else
+		atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static inline size_t shared_bucket_index(const ldasm_shared_cache* cache, uintptr_t address)
+{
+	return (size_t)((address >> 4) ^ (address >> cache->shift)) & cache->bucket_mask;
+}
+
+bool ldasm_shared_cache_init(ldasm_shared_cache* cache, size_t capacity, const ldasm_tables* tables, bool is64)
+{
+	if (!cache)
+		return false;
+
+	memset(cache, 0, sizeof(*cache));
+
+	size_t buckets = MIN_BUCKETS;
+	unsigned bits = 4;
+	while (buckets * SHARED_WAYS < capacity) {
+		buckets <<= 1;
+		++bits;
+	}
+
+	cache->buckets = aligned_alloc(64, buckets * sizeof(ldasm_shared_cache_bucket));
+	cache->stripes = aligned_alloc(64, (STRIPES + 1) * sizeof(ldasm_shared_cache_stripe));
+	if (!cache->buckets || !cache->stripes) {
+		ldasm_shared_cache_free(cache);
+		return false;
+	} //if
+
+	/* all zero: empty slots, even sequences, generation 0 */
+	memset(cache->buckets, 0, buckets * sizeof(ldasm_shared_cache_bucket));
+	memset(cache->stripes, 0, (STRIPES + 1) * sizeof(ldasm_shared_cache_stripe));
+	cache->bucket_mask = buckets - 1;
+	cache->shift = 4 + bits;
+	cache->tables = tables ? tables : ldasm_default_tables();
+	cache->is64 = is64;
+	return cache->tables != NULL;
+}
+
+void ldasm_shared_cache_free(ldasm_shared_cache* cache)
+{
+	if (!cache)
+		return;
+
+	free(cache->buckets);
+	free(cache->stripes);
+	memset(cache, 0, sizeof(*cache));
+}
+
+size_t ldasm_shared_cache_decode(ldasm_shared_cache* cache, const void* code, ldasm_insn* ld)
+{
+	const uintptr_t address = (uintptr_t)code;
+	uint8_t value[16];
+
+	if (!cache || !cache->buckets || !code || !ld)
+		return 0;
+
+	ldasm_shared_cache_bucket* bucket = &cache->buckets[shared_bucket_index(cache, address)];
+	ldasm_shared_cache_stripe* stripe = stripe_of(cache);
+	shared_slot* victim = NULL;
+
+	/* acquire pairs with the bump in invalidate, so a decode under the new generation sees the patch */
+	const uint32_t gen = atomic_load_explicit(&bucket->gen, memory_order_acquire);
+
+	for (size_t i = 0; i < SHARED_WAYS; i++) {
+		shared_slot* slot = &bucket->slots[i];
+
+		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		uintptr_t at = atomic_load_explicit(&slot->address, memory_order_relaxed);
+		uint32_t at_gen = atomic_load_explicit(&slot->gen, memory_order_relaxed);
+
+		if (at == address && !(seq & 1)) {
+			uint64_t v0 = atomic_load_explicit(&slot->value[0], memory_order_relaxed);
+			uint64_t v1 = atomic_load_explicit(&slot->value[1], memory_order_relaxed);
+
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq && at_gen == gen) {
+				memcpy(value, &v0, 8);
+				memcpy(value + 8, &v1, 8);
+				memcpy(ld, value, sizeof(*ld));
+				count(&stripe->hits);
+				return value[15];
+			} //if
+		} //if
+
+		/* reuse a stale copy of this address, else an empty or retired slot */
+		if (at == address || ((!at || at_gen != gen) && !victim))
+			victim = slot;
+	}
+
+	count(&stripe->misses);
+
+	size_t length = ldasm(code, cache->tables, ld, cache->is64);
+
+	if (!victim) {
+		victim = &bucket->slots[atomic_fetch_add_explicit(&bucket->clock, 1, memory_order_relaxed) % SHARED_WAYS];
+		count(&stripe->evictions);
+	} //if
+
+	uint32_t seq = atomic_load_explicit(&victim->seq, memory_order_relaxed);
+	if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&victim->seq, &seq, seq + 1,
+		memory_order_acquire, memory_order_relaxed)) {
+		count(&stripe->contended);
+		return length;
+	} //if
+
+	/* keep the stores below from passing the odd sequence */
+	atomic_thread_fence(memory_order_release);
+
+	uint64_t v0, v1;
+	memcpy(value, ld, sizeof(*ld));
+	value[15] = (uint8_t)length;
+	memcpy(&v0, value, 8);
+	memcpy(&v1, value + 8, 8);
+
+	atomic_store_explicit(&victim->address, address, memory_order_relaxed);
+	atomic_store_explicit(&victim->gen, gen, memory_order_relaxed);
+	atomic_store_explicit(&victim->value[0], v0, memory_order_relaxed);
+	atomic_store_explicit(&victim->value[1], v1, memory_order_relaxed);
+	atomic_store_explicit(&victim->seq, seq + 2, memory_order_release);
+	return length;
+}
+
+void ldasm_shared_cache_invalidate(ldasm_shared_cache* cache, const void* code, size_t size)
+{
+	const uintptr_t lo = (uintptr_t)code;
+
+	if (!cache || !cache->buckets || !size)
+		return;
+
+	/* instructions starting up to 15 bytes before the range may overlap it */
+	uintptr_t first = (lo < 15 ? 0 : lo - 15) >> 4;
+	uintptr_t last = (lo + size - 1) >> 4;
+
+	if (last - first > cache->bucket_mask) {
+		ldasm_shared_cache_flush(cache);
+		return;
+	} //if
+
+	for (uintptr_t block = first; block <= last; block++) {
+		ldasm_shared_cache_bucket* bucket = &cache->buckets[shared_bucket_index(cache, block << 4)];
+		atomic_fetch_add_explicit(&bucket->gen, 1, memory_order_release);
+	}
+}
+
+void ldasm_shared_cache_flush(ldasm_shared_cache* cache)
+{
+	if (!cache || !cache->buckets)
+		return;
+
+	for (size_t i = 0; i <= cache->bucket_mask; i++)
+		atomic_fetch_add_explicit(&cache->buckets[i].gen, 1, memory_order_release);
+}
+
+void ldasm_shared_cache_stats(const ldasm_shared_cache* cache, ldasm_cache_stats* stats)
+{
+	if (!stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!cache || !cache->stripes)
+		return;
+
+	for (size_t i = 0; i <= STRIPES; i++) {
+		ldasm_shared_cache_stripe* s = &cache->stripes[i];
+		stats->hits += atomic_load_explicit(&s->hits, memory_order_relaxed);
+		stats->misses += atomic_load_explicit(&s->misses, memory_order_relaxed);
+		stats->evictions += atomic_load_explicit(&s->evictions, memory_order_relaxed);
+		stats->contended += atomic_load_explicit(&s->contended, memory_order_relaxed);
+	}
+}
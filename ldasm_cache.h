@@ -0,0 +1,107 @@
+#pragma once
+
+#include "ldasm.h"
+
+typedef struct _ldasm_cache_entry
+{
+	uintptr_t  address;                 /* 0 = empty */
+	ldasm_insn ld;
+	uint8_t    length;
+} ldasm_cache_entry;
+
+typedef struct _ldasm_cache
+{
+	ldasm_cache_entry*  entries;        /* buckets of LDASM_CACHE_WAYS entries */
+	size_t              bucket_mask;
+	unsigned            shift;
+	unsigned            clock;          /* round-robin victim in a full bucket */
+	const ldasm_tables* tables;
+	bool                is64;
+
+	uint64_t            hits;
+	uint64_t            misses;
+	uint64_t            evictions;
+} ldasm_cache;
+
+#define LDASM_CACHE_WAYS 8
+
+/**
+ * @brief Allocate a cache for about capacity instructions, all memory is allocated here
+ */
+bool ldasm_cache_init(ldasm_cache* cache, size_t capacity, const ldasm_tables* tables, bool is64);
+
+/**
+ * @brief Release the cache memory
+ */
+void ldasm_cache_free(ldasm_cache* cache);
+
+/**
+ * @brief ldasm() through the cache, decodes and stores the instruction on a miss
+ */
+size_t ldasm_cache_decode(ldasm_cache* cache, const void* code, ldasm_insn* ld);
+
+/**
+ * @brief Drop every cached instruction overlapping [code, code + size), call after patching code
+ */
+void ldasm_cache_invalidate(ldasm_cache* cache, const void* code, size_t size);
+
+/**
+ * @brief Drop all cached instructions and reset the counters
+ */
+void ldasm_cache_clear(ldasm_cache* cache);
+
+typedef struct _ldasm_shared_cache_bucket ldasm_shared_cache_bucket;
+typedef struct _ldasm_shared_cache_stripe ldasm_shared_cache_stripe;
+
+typedef struct _ldasm_shared_cache
+{
+	ldasm_shared_cache_bucket* buckets;
+	ldasm_shared_cache_stripe* stripes;        /* counters, one cache line per thread, one more for the overflow */
+	size_t                     bucket_mask;
+	unsigned                   shift;
+	const ldasm_tables*        tables;
+	bool                       is64;
+} ldasm_shared_cache;
+
+typedef struct _ldasm_cache_stats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t contended;     /* inserts skipped because another thread was writing the slot */
+} ldasm_cache_stats;
+
+/**
+ * @brief Allocate a cache shared by any number of threads, all memory is allocated here
+ */
+bool ldasm_shared_cache_init(ldasm_shared_cache* cache, size_t capacity, const ldasm_tables* tables, bool is64);
+
+/**
+ * @brief Release the cache memory, no thread may be using it
+ */
+void ldasm_shared_cache_free(ldasm_shared_cache* cache);
+
+/**
+ * @brief ldasm() through the shared cache, never blocks
+ *
+ * Lookups and inserts are lock-free: a slot being written by another thread reads as a miss,
+ * and an insert into a slot another thread is writing is skipped.
+ */
+size_t ldasm_shared_cache_decode(ldasm_shared_cache* cache, const void* code, ldasm_insn* ld);
+
+/**
+ * @brief Retire every cached instruction overlapping [code, code + size), call after patching code
+ *
+ * Decodes that read the old bytes and finish after this returns are never served.
+ */
+void ldasm_shared_cache_invalidate(ldasm_shared_cache* cache, const void* code, size_t size);
+
+/**
+ * @brief Retire all cached instructions
+ */
+void ldasm_shared_cache_flush(ldasm_shared_cache* cache);
+
+/**
+ * @brief Sum the counters of all threads
+ */
+void ldasm_shared_cache_stats(const ldasm_shared_cache* cache, ldasm_cache_stats* stats);
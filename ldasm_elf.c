@@ -0,0 +1,326 @@
+#define _GNU_SOURCE
+
+#include "ldasm_elf.h"
+#include "ldasm_internal.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ELF32/ELF64 headers are read into the 64-bit structures so the indexer has a single code path.
+
+typedef struct _elf_image
+{
+	const uint8_t* data;
+	size_t         size;
+	bool           is32;
+	Elf64_Ehdr     ehdr;
+} elf_image;
+
+static inline bool in_image(const elf_image* img, uint64_t offset, uint64_t size)
+{
+	return offset <= img->size && size <= img->size - offset;
+}
+
+static bool read_ehdr(elf_image* img)
+{
+	if (img->size < EI_NIDENT || memcmp(img->data, ELFMAG, SELFMAG) != 0)
+		return false;
+
+	if (img->data[EI_DATA] != ELFDATA2LSB)
+		return false;
+
+	img->is32 = img->data[EI_CLASS] == ELFCLASS32;
+
+	if (img->is32) {
+		Elf32_Ehdr h;
+		if (!in_image(img, 0, sizeof(h)))
+			return false;
+		memcpy(&h, img->data, sizeof(h));
+		img->ehdr.e_machine = h.e_machine;
+		img->ehdr.e_shoff = h.e_shoff;
+		img->ehdr.e_shentsize = h.e_shentsize;
+		img->ehdr.e_shnum = h.e_shnum;
+		return h.e_shentsize == sizeof(Elf32_Shdr);
+	} //if
+
+	if (img->data[EI_CLASS] != ELFCLASS64 || !in_image(img, 0, sizeof(Elf64_Ehdr)))
+		return false;
+
+	memcpy(&img->ehdr, img->data, sizeof(Elf64_Ehdr));
+	return img->ehdr.e_shentsize == sizeof(Elf64_Shdr);
+}
+
+static bool read_shdr(const elf_image* img, size_t i, Elf64_Shdr* sh)
+{
+	uint64_t offset = img->ehdr.e_shoff + i * img->ehdr.e_shentsize;
+
+	if (i >= img->ehdr.e_shnum || !in_image(img, offset, img->ehdr.e_shentsize))
+		return false;
+
+	if (img->is32) {
+		Elf32_Shdr s;
+		memcpy(&s, img->data + offset, sizeof(s));
+		sh->sh_type = s.sh_type;
+		sh->sh_flags = s.sh_flags;
+		sh->sh_addr = s.sh_addr;
+		sh->sh_offset = s.sh_offset;
+		sh->sh_size = s.sh_size;
+		sh->sh_link = s.sh_link;
+		sh->sh_entsize = s.sh_entsize;
+	}
+	else {
+		memcpy(sh, img->data + offset, sizeof(*sh));
+	} //if
+
+	return true;
+}
+
+static void read_sym(const elf_image* img, const uint8_t* p, Elf64_Sym* sym)
+{
+	if (img->is32) {
+		Elf32_Sym s;
+		memcpy(&s, p, sizeof(s));
+		sym->st_info = s.st_info;
+		sym->st_shndx = s.st_shndx;
+		sym->st_value = s.st_value;
+		sym->st_size = s.st_size;
+	}
+	else {
+		memcpy(sym, p, sizeof(*sym));
+	} //if
+}
+
+static int compare_funcs(const void* a, const void* b)
+{
+	const ldasm_func* x = (const ldasm_func*)a;
+	const ldasm_func* y = (const ldasm_func*)b;
+
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+
+	/* larger size first so the merge keeps it */
+	return x->size > y->size ? -1 : x->size < y->size;
+}
+
+/* size a function and find its first invalid instruction, limit is the distance to the next function */
+void ldasm_measure_func(ldasm_func* f, const uint8_t* code, size_t avail, size_t limit, const ldasm_tables* tables, bool is64)
+{
+	ldasm_insn ld;
+	size_t pos = 0, n;
+
+	if (!f->size) {
+		n = ldasm_size_of_proc_cfg(code, limit < avail ? limit : avail, tables, is64, NULL);
+		f->size = (uint32_t)(n == LDASM_TRUNCATED || !n ? (limit < avail ? limit : avail) : n);
+	} //if
+
+	if (f->size > avail)
+		f->size = (uint32_t)avail;
+
+	f->invalid = f->size;
+
+	/* every instruction must be valid and the last one must end exactly at st_size */
+	for (; pos < f->size; pos += n) {
+		n = ldasm_ex(code + pos, f->size - pos, tables, &ld, is64);
+		if (n == LDASM_TRUNCATED || (ld.flags & DF_INVALID)) {
+			f->invalid = (uint32_t)pos;
+			break;
+		} //if
+	}
+}
+
+bool ldasm_elf_index_build(ldasm_elf_index* index, const void* image, size_t size, const ldasm_tables* tables)
+{
+	elf_image img = { .data = (const uint8_t*)image, .size = size };
+	Elf64_Shdr sh, link;
+	size_t cap = 0;
+
+	if (!index || !image)
+		return false;
+
+	memset(index, 0, sizeof(*index));
+	index->image = img.data;
+	index->image_size = size;
+
+	if (!read_ehdr(&img))
+		return false;
+
+	if (img.ehdr.e_machine == EM_X86_64)
+		index->is64 = true;
+	else if (img.ehdr.e_machine != EM_386)
+		return false;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	/* executable sections, kept by section index for symbol lookups */
+	size_t shnum = img.ehdr.e_shnum;
+	int* exec = calloc(shnum ? shnum : 1, sizeof(int));
+	index->sections = calloc(shnum ? shnum : 1, sizeof(ldasm_elf_section));
+	if (!exec || !index->sections) {
+		free(exec);
+		ldasm_elf_index_close(index);
+		return false;
+	} //if
+
+	for (size_t i = 0; i < shnum; i++) {
+		exec[i] = -1;
+		if (!read_shdr(&img, i, &sh))
+			continue;
+		if (sh.sh_type != SHT_PROGBITS || !(sh.sh_flags & SHF_EXECINSTR) || !in_image(&img, sh.sh_offset, sh.sh_size))
+			continue;
+
+		exec[i] = (int)index->section_count;
+		index->sections[index->section_count++] = (ldasm_elf_section){ sh.sh_addr, sh.sh_size, sh.sh_offset };
+	}
+
+	/* function symbols from .symtab and .dynsym */
+	for (size_t i = 0; i < shnum; i++) {
+		if (!read_shdr(&img, i, &sh) || (sh.sh_type != SHT_SYMTAB && sh.sh_type != SHT_DYNSYM))
+			continue;
+
+		size_t entsize = img.is32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym);
+		if (!in_image(&img, sh.sh_offset, sh.sh_size) || !read_shdr(&img, sh.sh_link, &link))
+			continue;
+
+		size_t nsyms = sh.sh_size / entsize;
+		for (size_t k = 0; k < nsyms; k++) {
+			Elf64_Sym sym;
+			read_sym(&img, img.data + sh.sh_offset + k * entsize, &sym);
+
+			int type = ELF64_ST_TYPE(sym.st_info);
+			if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym.st_shndx >= shnum || exec[sym.st_shndx] < 0)
+				continue;
+
+			const ldasm_elf_section* sec = &index->sections[exec[sym.st_shndx]];
+			if (sym.st_value < sec->addr || sym.st_value >= sec->addr + sec->size || sym.st_size > UINT32_MAX)
+				continue;
+
+			if (index->count == cap) {
+				cap = cap ? cap * 2 : 256;
+				ldasm_func* funcs = realloc(index->funcs, cap * sizeof(ldasm_func));
+				if (!funcs) {
+					free(exec);
+					ldasm_elf_index_close(index);
+					return false;
+				} //if
+				index->funcs = funcs;
+			} //if
+
+			index->funcs[index->count++] = (ldasm_func){ sym.st_value, (uint32_t)sym.st_size, 0 };
+		}
+	}
+
+	free(exec);
+
+	/* sort and drop aliases, .symtab and .dynsym list most functions twice */
+	if (index->count)
+		qsort(index->funcs, index->count, sizeof(ldasm_func), compare_funcs);
+
+	size_t n = 0;
+	for (size_t i = 0; i < index->count; i++) {
+		if (n && index->funcs[n - 1].start == index->funcs[i].start)
+			continue;
+		index->funcs[n++] = index->funcs[i];
+	}
+	index->count = n;
+
+	for (size_t i = 0; i < index->count; i++) {
+		ldasm_func* f = &index->funcs[i];
+		size_t avail;
+		const uint8_t* code = ldasm_elf_code(index, f->start, &avail);
+
+		size_t limit = i + 1 < index->count ? (size_t)(index->funcs[i + 1].start - f->start) : avail;
+
+		ldasm_measure_func(f, code, avail, limit, tables, index->is64);
+	}
+
+	return true;
+}
+
+bool ldasm_elf_index_open(ldasm_elf_index* index, const char* path, const ldasm_tables* tables)
+{
+	struct stat st;
+	void* image;
+
+	if (!index || !path)
+		return false;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return false;
+	} //if
+
+	image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (image == MAP_FAILED)
+		return false;
+
+	if (!ldasm_elf_index_build(index, image, (size_t)st.st_size, tables)) {
+		munmap(image, (size_t)st.st_size);
+		return false;
+	} //if
+
+	index->mapped = true;
+	return true;
+}
+
+void ldasm_elf_index_close(ldasm_elf_index* index)
+{
+	if (!index)
+		return;
+
+	if (index->mapped)
+		munmap((void*)index->image, index->image_size);
+
+	free(index->funcs);
+	free(index->sections);
+	memset(index, 0, sizeof(*index));
+}
+
+const ldasm_func* ldasm_elf_lookup(const ldasm_elf_index* index, uint64_t addr)
+{
+	size_t lo = 0, hi = index ? index->count : 0;
+
+	/* last function starting at or before addr */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->funcs[mid].start <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!lo)
+		return NULL;
+
+	const ldasm_func* f = &index->funcs[lo - 1];
+	return addr - f->start < f->size ? f : NULL;
+}
+
+const uint8_t* ldasm_elf_code(const ldasm_elf_index* index, uint64_t addr, size_t* avail)
+{
+	for (size_t i = 0; index && i < index->section_count; i++) {
+		const ldasm_elf_section* sec = &index->sections[i];
+
+		if (addr >= sec->addr && addr - sec->addr < sec->size) {
+			if (avail)
+				*avail = (size_t)(sec->size - (addr - sec->addr));
+			return index->image + sec->offset + (addr - sec->addr);
+		} //if
+	}
+
+	if (avail)
+		*avail = 0;
+
+	return NULL;
+}
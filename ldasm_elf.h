@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ldasm.h"
+
+typedef struct _ldasm_func
+{
+	uint64_t start;     /* virtual address */
+	uint32_t size;      /* st_size, or the decoded procedure size for symbols without one */
+	uint32_t invalid;   /* offset of the first invalid or cut-off instruction, size if none */
+} ldasm_func;
+
+typedef struct _ldasm_elf_section
+{
+	uint64_t addr;      /* virtual address */
+	uint64_t size;
+	uint64_t offset;    /* file offset */
+} ldasm_elf_section;
+
+typedef struct _ldasm_elf_index
+{
+	ldasm_func*        funcs;       /* sorted by start, no duplicates */
+	size_t             count;
+	ldasm_elf_section* sections;    /* executable PROGBITS sections */
+	size_t             section_count;
+	bool               is64;        /* x86-64 (EM_X86_64) or x86 (EM_386) code */
+	const uint8_t*     image;       /* file contents */
+	size_t             image_size;
+	bool               mapped;      /* image was mapped by ldasm_elf_index_open() */
+} ldasm_elf_index;
+
+/**
+ * @brief Map an ELF32/ELF64 file read-only and index the functions in its executable sections
+ */
+bool ldasm_elf_index_open(ldasm_elf_index* index, const char* path, const ldasm_tables* tables);
+
+/**
+ * @brief Index an ELF image that is already in memory (the image must outlive the index)
+ */
+bool ldasm_elf_index_build(ldasm_elf_index* index, const void* image, size_t size, const ldasm_tables* tables);
+
+/**
+ * @brief Release the function table and unmap the file if it was mapped
+ */
+void ldasm_elf_index_close(ldasm_elf_index* index);
+
+/**
+ * @brief Find the function containing a virtual address
+ * @return Function entry, or NULL if the address is not inside a known function
+ */
+const ldasm_func* ldasm_elf_lookup(const ldasm_elf_index* index, uint64_t addr);
+
+/**
+ * @brief Translate a virtual address inside an executable section to a pointer into the image
+ *
+ * The number of bytes up to the end of the section is stored in avail (may be NULL).
+ *
+ * @return Pointer to the code, or NULL if the address is not in an executable section
+ */
+const uint8_t* ldasm_elf_code(const ldasm_elf_index* index, uint64_t addr, size_t* avail);
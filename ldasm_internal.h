@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ldasm.h"
+
+// Instruction format:
+// | prefix | REX | opcode | modR/M | SIB | disp8/16/32 | imm8/16/32/64 |
+
+#define OP_NONE             0x00
+#define OP_INVALID          0x80
+
+#define OP_DATA_I8          0x01
+#define OP_DATA_I16         0x02
+#define OP_DATA_I16_I32     0x04
+#define OP_DATA_I16_I32_I64 0x08
+#define OP_EXTENDED         0x10
+#define OP_RELATIVE         0x20
+#define OP_MODRM            0x40
+#define OP_PREFIX           0x80
+
+#if defined(_MSC_VER)
+#define LDASM_ALIGN(n) __declspec(align(n))
+#else
+#define LDASM_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline unsigned ldasm_ctz64(uint64_t x)
+{
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return (unsigned)i;
+}
+
+static inline unsigned ldasm_popcount64(uint64_t x)
+{
+	return (unsigned)__popcnt64(x);
+}
+#else
+static inline unsigned ldasm_ctz64(uint64_t x)
+{
+	return (unsigned)__builtin_ctzll(x);
+}
+
+static inline unsigned ldasm_popcount64(uint64_t x)
+{
+	return (unsigned)__builtin_popcountll(x);
+}
+#endif
+
+/* widest SIMD kernel the CPU can run, see ldasm_simd.c */
+enum ldasm_simd_level
+{
+	LDASM_SIMD_NONE,
+	LDASM_SIMD_SSSE3,
+	LDASM_SIMD_AVX2
+};
+
+enum ldasm_simd_level ldasm_simd_level(void);
+
+/* size a function without st_size and find its first invalid instruction, limit is the distance to
+ * the next function, see ldasm_elf.c */
+struct _ldasm_func;
+void ldasm_measure_func(struct _ldasm_func* f, const uint8_t* code, size_t avail, size_t limit,
+	const ldasm_tables* tables, bool is64);
+
+/* real instruction boundaries of a linear sweep as a bitmap of len bits, zeroed by the caller,
+ * see ldasm_parallel.c; returns the instruction count */
+size_t ldasm_sweep_boundaries(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	uint64_t* bits, unsigned threads, size_t* consumed);
+
+/* decoder counters, see ldasm_stats.h */
+#ifdef LDASM_STATS
+#include "ldasm_stats.h"
+
+#include <stdatomic.h>
+
+#define LDASM_STATS_COUNTERS (sizeof(ldasm_stats) / sizeof(uint64_t))
+
+typedef struct _ldasm_stats_block
+{
+	_Atomic uint64_t           counters[LDASM_STATS_COUNTERS];   /* laid out as ldasm_stats */
+	struct _ldasm_stats_block* next;
+	bool                       shared;                           /* written by several threads */
+} ldasm_stats_block;
+
+extern _Thread_local ldasm_stats_block* ldasm_thread_stats;
+
+ldasm_stats_block* ldasm_stats_attach(void);
+
+/* a block of one thread only needs a relaxed load and store, the shared one an atomic add */
+static inline void ldasm_stats_add(ldasm_stats_block* block, size_t index, uint64_t n)
+{
+	if (block->shared)
+		atomic_fetch_add_explicit(&block->counters[index], n, memory_order_relaxed);
+	else
+		atomic_store_explicit(&block->counters[index],
+			atomic_load_explicit(&block->counters[index], memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+#define LDASM_STATS_BEGIN() \
+	ldasm_stats_block* stats_ = ldasm_thread_stats ? ldasm_thread_stats : ldasm_stats_attach()
+#define LDASM_COUNT_ADD(field, n) \
+	ldasm_stats_add(stats_, offsetof(ldasm_stats, field) / sizeof(uint64_t), (n))
+#define LDASM_COUNT(field) \
+	LDASM_COUNT_ADD(field, 1)
+#define LDASM_COUNT_OPCODE(histogram, op) \
+	ldasm_stats_add(stats_, offsetof(ldasm_stats, histogram) / sizeof(uint64_t) + (op), 1)
+#else
+#define LDASM_STATS_BEGIN()               ((void)0)
+#define LDASM_COUNT_ADD(field, n)         ((void)0)
+#define LDASM_COUNT(field)                ((void)0)
+#define LDASM_COUNT_OPCODE(histogram, op) ((void)0)
+#endif
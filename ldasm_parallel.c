@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+
+#include "ldasm_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Parallel speculative linear sweep.
+//
+// The buffer is split into chunks and every chunk is decoded from its first byte as if an
+// instruction started there. The instruction boundaries found are recorded in a bitmap.
+// x86 code resynchronizes quickly, so when the previous chunk's real stream runs into the
+// chunk, it hits one of the speculative boundaries after a few instructions. From that point
+// the speculative result is exact. Chunks are reconciled in order, and then every chunk
+// emits its real instructions in parallel, so the output equals ldasm_sweep().
+
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define LENGTH_BATCH   4096
+
+typedef struct _sweep_chunk
+{
+	/* speculative decode, [begin, end) is the range owned by the chunk */
+	size_t begin;
+	size_t end;
+	size_t spec_end;
+	size_t spec_count;
+	bool   spec_truncated;
+
+	/* real stream after reconciliation */
+	size_t start;
+	size_t stop;
+	size_t count;
+	size_t base;
+	bool   truncated;
+} sweep_chunk;
+
+typedef struct _sweep_job
+{
+	const uint8_t*      code;
+	size_t              len;
+	const ldasm_tables* tables;
+	bool                is64;
+	uint64_t*           bits;
+	sweep_chunk*        chunk;
+
+	/* output stage */
+	ldasm_insn*         out;
+	uint8_t*            lengths;
+	size_t              cap;
+	size_t              consumed;
+	pthread_t           thread;
+} sweep_job;
+
+static inline bool test_bit(const uint64_t* bits, size_t i)
+{
+	return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void set_bit(uint64_t* bits, size_t i)
+{
+	bits[i >> 6] |= 1ull << (i & 63);
+}
+
+static void clear_bits(uint64_t* bits, size_t from, size_t to)
+{
+	for (size_t i = from; i < to; i++)
+		bits[i >> 6] &= ~(1ull << (i & 63));
+}
+
+static size_t count_bits(const uint64_t* bits, size_t from, size_t to)
+{
+	size_t n = 0;
+	for (size_t i = from; i < to; i++)
+		n += test_bit(bits, i);
+	return n;
+}
+
+/* phase 1: speculative decode of [begin, end), instructions may run past end */
+static void* speculate(void* arg)
+{
+	sweep_job* job = (sweep_job*)arg;
+	sweep_chunk* c = job->chunk;
+	uint8_t lengths[LENGTH_BATCH];
+	size_t pos = c->begin, consumed;
+
+	c->spec_count = 0;
+	c->spec_truncated = false;
+
+	while (pos < c->end) {
+		size_t n = ldasm_sweep_lengths(job->code + pos, job->len - pos, job->tables, job->is64,
+			lengths, LENGTH_BATCH, &consumed);
+
+		for (size_t i = 0; i < n && pos < c->end; i++) {
+			set_bit(job->bits, pos);
+			pos += lengths[i];
+			++c->spec_count;
+		}
+
+		/* stopped short of the batch size: the rest of the buffer is a truncated instruction */
+		if (n < LENGTH_BATCH && pos < c->end) {
+			c->spec_truncated = true;
+			break;
+		} //if
+	}
+
+	c->spec_end = pos;
+	return NULL;
+}
+
+/* phase 2: follow the real stream from start until it meets a speculative boundary */
+static void reconcile(sweep_job* job, size_t start)
+{
+	sweep_chunk* c = job->chunk;
+	size_t pos = start, resync = 0, n;
+	ldasm_insn ld;
+	bool truncated = false;
+
+	c->start = start;
+
+	while (pos < c->end && !test_bit(job->bits, pos)) {
+		n = ldasm_ex(job->code + pos, job->len - pos, job->tables, &ld, job->is64);
+		if (n == LDASM_TRUNCATED) {
+			truncated = true;
+			break;
+		} //if
+		pos += n;
+		++resync;
+	}
+
+	bool synced = !truncated && pos < c->end;
+	size_t sync = synced ? pos : c->end;
+
+	if (synced) {
+		c->count = resync + c->spec_count - count_bits(job->bits, c->begin, sync);
+		c->stop = c->spec_end;
+		c->truncated = c->spec_truncated;
+	}
+	else {
+		c->count = resync;
+		c->stop = pos;
+		c->truncated = truncated;
+	} //if
+
+	/* replace the speculative boundaries before the sync point with the real ones */
+	clear_bits(job->bits, c->begin, sync);
+	for (pos = start; pos < sync; pos += n) {
+		set_bit(job->bits, pos);
+		n = ldasm_ex(job->code + pos, job->len - pos, job->tables, &ld, job->is64);
+		if (n == LDASM_TRUNCATED)
+			break;
+	}
+}
+
+/* lengths are the distances between real boundaries, no need to decode again */
+static size_t emit_lengths(const uint64_t* bits, size_t start, size_t stop, uint8_t* lengths, size_t cap)
+{
+	size_t pos = start, count = 0;
+
+	while (count < cap) {
+		size_t next = pos + 1;
+		uint64_t word = next < stop ? bits[next >> 6] & (~0ull << (next & 63)) : 0;
+
+		while (!word && (next | 63) + 1 < stop) {
+			next = (next | 63) + 1;
+			word = bits[next >> 6];
+		}
+
+		next = word ? (next & ~(size_t)63) + ldasm_ctz64(word) : stop;
+		if (next > stop)
+			next = stop;
+
+		lengths[count++] = (uint8_t)(next - pos);
+		pos = next;
+	}
+
+	return pos - start;
+}
+
+/* phase 3: emit the real instructions of a chunk */
+static void* emit(void* arg)
+{
+	sweep_job* job = (sweep_job*)arg;
+	sweep_chunk* c = job->chunk;
+	size_t cap = c->count;
+
+	if (c->base + cap > job->cap)
+		cap = job->cap - c->base;
+
+	if (!job->out && job->lengths) {
+		job->consumed = emit_lengths(job->bits, c->start, c->stop, job->lengths + c->base, cap);
+		return NULL;
+	} //if
+
+	ldasm_sweep(job->code + c->start, c->stop - c->start, job->tables, job->is64,
+		job->out ? job->out + c->base : NULL, job->lengths ? job->lengths + c->base : NULL, cap, &job->consumed);
+
+	return NULL;
+}
+
+static void run_jobs(sweep_job* jobs, size_t n, void* (*fn)(void*))
+{
+	bool* started = calloc(n, sizeof(bool));
+
+	/* jobs whose thread could not be started run on the calling thread */
+	for (size_t i = 1; started && i < n; i++)
+		started[i] = pthread_create(&jobs[i].thread, NULL, fn, &jobs[i]) == 0;
+
+	fn(&jobs[0]);
+
+	for (size_t i = 1; i < n; i++) {
+		if (started && started[i])
+			pthread_join(jobs[i].thread, NULL);
+		else
+			fn(&jobs[i]);
+	}
+
+	free(started);
+}
+
+static unsigned cpu_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1u;
+}
+
+static size_t speculate_boundaries(const uint8_t* code, size_t len, const ldasm_tables* tables, bool is64,
+	uint64_t* bits, unsigned threads, sweep_chunk** chunks_out, size_t* nchunks_out)
+{
+	size_t n = threads ? threads : cpu_count();
+
+	if (n > len / MIN_CHUNK_SIZE)
+		n = len / MIN_CHUNK_SIZE;
+	if (!n)
+		n = 1;
+
+	sweep_job* jobs = calloc(n, sizeof(sweep_job));
+	sweep_chunk* chunks = calloc(n, sizeof(sweep_chunk));
+	if (!jobs || !chunks) {
+		free(jobs);
+		free(chunks);
+		return 0;
+	} //if
+
+	/* chunk borders are 64 byte aligned so every thread owns whole bitmap words */
+	for (size_t i = 0; i < n; i++) {
+		chunks[i].begin = i ? (len / n * i) & ~(size_t)63 : 0;
+		chunks[i].end = i + 1 < n ? (len / n * (i + 1)) & ~(size_t)63 : len;
+		jobs[i] = (sweep_job){ .code = code, .len = len, .tables = tables, .is64 = is64, .bits = bits, .chunk = &chunks[i] };
+	}
+
+	run_jobs(jobs, n, speculate);
+
+	/* reconcile chunk borders in order */
+	size_t total = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (i == 0) {
+			chunks[0].start = 0;
+			chunks[0].stop = chunks[0].spec_end;
+			chunks[0].count = chunks[0].spec_count;
+			chunks[0].truncated = chunks[0].spec_truncated;
+		}
+		else if (chunks[i - 1].truncated || chunks[i - 1].stop >= chunks[i].end) {
+			/* previous stream ended or jumped over the whole chunk */
+			clear_bits(bits, chunks[i].begin, chunks[i].end);
+			chunks[i].start = chunks[i].stop = chunks[i - 1].stop;
+			chunks[i].count = 0;
+			chunks[i].truncated = chunks[i - 1].truncated;
+		}
+		else {
+			reconcile(&jobs[i], chunks[i - 1].stop);
+		} //if
+
+		chunks[i].base = total;
+		total += chunks[i].count;
+	}
+
+	free(jobs);
+
+	*chunks_out = chunks;
+	*nchunks_out = n;
+	return total;
+}
+
+size_t ldasm_sweep_boundaries(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	uint64_t* bits, unsigned threads, size_t* consumed)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	sweep_chunk* chunks = NULL;
+	size_t nchunks = 0, total;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	/* the bitmap left behind by reconciliation is exactly the real stream */
+	total = p ? speculate_boundaries(p, len, tables, is64, bits, threads, &chunks, &nchunks) : 0;
+
+	if (consumed)
+		*consumed = chunks ? chunks[nchunks - 1].stop : 0;
+
+	if (!chunks && p) {
+		/* no memory for the chunks, sweep on this thread */
+		uint8_t lengths[LENGTH_BATCH];
+		size_t pos = 0, n;
+
+		total = 0;
+		do {
+			n = ldasm_sweep_lengths(p + pos, len - pos, tables, is64, lengths, LENGTH_BATCH, NULL);
+			for (size_t i = 0; i < n; i++) {
+				set_bit(bits, pos);
+				pos += lengths[i];
+			}
+			total += n;
+		} while (n == LENGTH_BATCH);
+
+		if (consumed)
+			*consumed = pos;
+	} //if
+
+	free(chunks);
+	return total;
+}
+
+size_t ldasm_sweep_parallel(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	ldasm_insn* out, uint8_t* lengths, size_t cap, size_t* consumed, unsigned threads)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	sweep_chunk* chunks = NULL;
+	size_t nchunks = 0;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	if (!p || threads == 1 || len < 2 * MIN_CHUNK_SIZE)
+		return ldasm_sweep(code, len, tables, is64, out, lengths, cap, consumed);
+
+	uint64_t* bits = calloc((len + 63) / 64, sizeof(uint64_t));
+	if (!bits)
+		return ldasm_sweep(code, len, tables, is64, out, lengths, cap, consumed);
+
+	size_t total = speculate_boundaries(p, len, tables, is64, bits, threads, &chunks, &nchunks);
+
+	sweep_job* jobs = chunks ? calloc(nchunks, sizeof(sweep_job)) : NULL;
+	size_t njobs = 0;
+
+	if (!jobs) {
+		free(bits);
+		free(chunks);
+		return ldasm_sweep(code, len, tables, is64, out, lengths, cap, consumed);
+	} //if
+
+	/* only chunks below cap are emitted; count-only sweeps just need the chunk reaching cap */
+	for (size_t i = 0; i < nchunks; i++) {
+		if (chunks[i].base >= cap || !chunks[i].count)
+			continue;
+		if (!out && !lengths && chunks[i].base + chunks[i].count < cap)
+			continue;
+		jobs[njobs++] = (sweep_job){ .code = p, .len = len, .tables = tables, .is64 = is64, .bits = bits, .chunk = &chunks[i],
+			.out = out, .lengths = lengths, .cap = cap };
+	}
+
+	if (njobs)
+		run_jobs(jobs, njobs, emit);
+
+	if (consumed) {
+		/* the stream ends in the chunk where the running count reaches cap, or at its end */
+		*consumed = total < cap ? chunks[nchunks - 1].stop : 0;
+		for (size_t i = 0; i < njobs; i++) {
+			const sweep_chunk* c = jobs[i].chunk;
+			if (c->base < cap && cap <= c->base + c->count) {
+				*consumed = c->base + c->count == cap ? c->stop : c->start + jobs[i].consumed;
+				break;
+			} //if
+		}
+	} //if
+
+	free(jobs);
+	free(chunks);
+	free(bits);
+
+	return total < cap ? total : cap;
+}
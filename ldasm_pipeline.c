@@ -0,0 +1,882 @@
+#define _GNU_SOURCE
+
+#include "ldasm_pipeline.h"
+#include "ldasm_elf.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Multi-file scanning pipeline.
+//
+// discovery -> loaders -> decode pool -> caller, each arrow a bounded queue. The loaders map a
+// file with MAP_POPULATE, so its pages are read in while the pool decodes earlier files, and wait
+// on the memory budget before mapping. A worker that takes a file indexes it, then splits its
+// executable sections into slices and pushes one task per slice onto its own deque; idle workers
+// steal from the other end of the others' deques, so one large file still spreads over the pool.
+//
+// A slice is swept from its first byte as if an instruction started there, recording the first
+// HEADS instruction starts with the counts before each. The worker finishing the last task of a
+// file walks the slices in order and follows the real stream into each one until it meets one of
+// those starts, from there on the speculative counts are exact, like ldasm_sweep_parallel().
+
+#define DEFAULT_LOADERS 2
+#define DEFAULT_BUDGET  ((size_t)512 << 20)
+#define DEFAULT_DEPTH   64
+#define DEFAULT_SLICE   ((size_t)256 << 10)
+#define SWEEP_BATCH     4096
+#define HEADS           32
+#define INDEX_TASK      SIZE_MAX
+
+typedef struct _pipe_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  not_empty;
+	pthread_cond_t  not_full;
+	void**          items;
+	size_t          cap;
+	size_t          head;
+	size_t          count;
+	bool            closed;
+} pipe_queue;
+
+typedef struct _sweep_counts
+{
+	uint64_t insns;
+	uint64_t invalid_insns;
+	uint64_t invalid_bytes;
+} sweep_counts;
+
+/* an instruction start of the speculative stream and the counts before it */
+typedef struct _sweep_head
+{
+	size_t       pos;
+	sweep_counts before;
+} sweep_head;
+
+typedef struct _pipe_slice
+{
+	const uint8_t* code;        /* section */
+	size_t         len;
+	size_t         begin;       /* [begin, end) is owned by the slice */
+	size_t         end;
+	bool           first;       /* first slice of its section */
+
+	/* speculative stream from begin */
+	size_t         stop;
+	bool           truncated;
+	sweep_counts   spec;
+	size_t         head_count;
+	sweep_head     heads[HEADS];
+} pipe_slice;
+
+typedef struct _pipe_file
+{
+	char*               path;
+	uint8_t*            image;
+	size_t              size;
+	ldasm_elf_index     index;
+	bool                indexed;
+	bool                failed;
+	pipe_slice*         slices;
+	size_t              slice_count;
+	_Atomic size_t      pending;        /* tasks not finished yet */
+	ldasm_pipeline_file result;
+} pipe_file;
+
+typedef struct _pipe_task
+{
+	pipe_file* file;
+	size_t     slice;           /* INDEX_TASK to index the file */
+} pipe_task;
+
+/* owner pushes and pops at the back, thieves take from the front */
+typedef struct _pipe_deque
+{
+	pthread_mutex_t lock;
+	pipe_task*      tasks;
+	size_t          cap;
+	size_t          head;
+	size_t          count;
+} pipe_deque;
+
+struct _pipeline;
+
+typedef struct _pipe_worker
+{
+	struct _pipeline* pipe;
+	pipe_deque        deque;
+	unsigned          id;
+	pthread_t         thread;
+	bool              started;
+	ldasm_insn*       out;
+	uint8_t*          lengths;
+	size_t            tasks;
+	size_t            steals;
+} pipe_worker;
+
+typedef struct _pipeline
+{
+	const char* const*  paths;
+	size_t              path_count;
+	const ldasm_tables* tables;
+	size_t              budget;
+	size_t              slice_size;
+
+	pipe_queue          found;          /* discovery -> loaders, paths */
+	pipe_queue          loaded;         /* loaders -> pool, mapped files */
+	pipe_queue          done;           /* pool -> caller, scanned files */
+
+	pthread_mutex_t     budget_lock;
+	pthread_cond_t      budget_freed;
+	size_t              mapped;
+	size_t              peak;
+
+	pipe_worker*        workers;
+	unsigned            worker_count;
+	pthread_mutex_t     pool_lock;
+	pthread_cond_t      pool_wake;
+	uint64_t            epoch;          /* bumped whenever work shows up */
+	unsigned            sleepers;
+
+	_Atomic size_t      in_flight;      /* files handed to the pool and not finished */
+	_Atomic bool        loaded_closed;
+	_Atomic unsigned    loaders_live;
+	_Atomic unsigned    workers_live;
+	_Atomic size_t      skipped;
+	_Atomic size_t      failed;
+} pipeline;
+
+static unsigned cpu_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1u;
+}
+
+static bool queue_init(pipe_queue* q, size_t cap)
+{
+	memset(q, 0, sizeof(*q));
+	q->items = malloc(cap * sizeof(void*));
+	q->cap = cap;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+
+	return q->items != NULL;
+}
+
+static void queue_destroy(pipe_queue* q)
+{
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+	free(q->items);
+}
+
+/* blocks while the queue is full, false once it is closed */
+static bool queue_push(pipe_queue* q, void* item)
+{
+	pthread_mutex_lock(&q->lock);
+
+	while (q->count == q->cap && !q->closed)
+		pthread_cond_wait(&q->not_full, &q->lock);
+
+	bool ok = !q->closed;
+	if (ok) {
+		q->items[(q->head + q->count++) % q->cap] = item;
+		pthread_cond_signal(&q->not_empty);
+	} //if
+
+	pthread_mutex_unlock(&q->lock);
+	return ok;
+}
+
+/* blocks while the queue is empty (if wait), false once it is closed and drained */
+static bool queue_pop(pipe_queue* q, void** item, bool wait)
+{
+	pthread_mutex_lock(&q->lock);
+
+	while (wait && !q->count && !q->closed)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+
+	bool ok = q->count != 0;
+	if (ok) {
+		*item = q->items[q->head];
+		q->head = (q->head + 1) % q->cap;
+		--q->count;
+		pthread_cond_signal(&q->not_full);
+	} //if
+
+	pthread_mutex_unlock(&q->lock);
+	return ok;
+}
+
+static void queue_close(pipe_queue* q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = true;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static bool deque_push(pipe_deque* d, pipe_task task)
+{
+	pthread_mutex_lock(&d->lock);
+
+	if (d->count == d->cap) {
+		size_t cap = d->cap ? d->cap * 2 : 64;
+		pipe_task* tasks = malloc(cap * sizeof(pipe_task));
+		if (!tasks) {
+			pthread_mutex_unlock(&d->lock);
+			return false;
+		} //if
+
+		for (size_t i = 0; i < d->count; i++)
+			tasks[i] = d->tasks[(d->head + i) % d->cap];
+
+		free(d->tasks);
+		d->tasks = tasks;
+		d->cap = cap;
+		d->head = 0;
+	} //if
+
+	d->tasks[(d->head + d->count++) % d->cap] = task;
+
+	pthread_mutex_unlock(&d->lock);
+	return true;
+}
+
+static bool deque_pop(pipe_deque* d, pipe_task* task, bool front)
+{
+	pthread_mutex_lock(&d->lock);
+
+	bool ok = d->count != 0;
+	if (ok && front) {
+		*task = d->tasks[d->head];
+		d->head = (d->head + 1) % d->cap;
+		--d->count;
+	}
+	else if (ok) {
+		*task = d->tasks[(d->head + --d->count) % d->cap];
+	} //if
+
+	pthread_mutex_unlock(&d->lock);
+	return ok;
+}
+
+static void budget_acquire(pipeline* p, size_t size)
+{
+	pthread_mutex_lock(&p->budget_lock);
+
+	/* a file larger than the whole budget waits until it can be mapped alone */
+	while (p->mapped && p->mapped + size > p->budget)
+		pthread_cond_wait(&p->budget_freed, &p->budget_lock);
+
+	p->mapped += size;
+	if (p->mapped > p->peak)
+		p->peak = p->mapped;
+
+	pthread_mutex_unlock(&p->budget_lock);
+}
+
+static void budget_release(pipeline* p, size_t size)
+{
+	pthread_mutex_lock(&p->budget_lock);
+	p->mapped -= size;
+	pthread_cond_broadcast(&p->budget_freed);
+	pthread_mutex_unlock(&p->budget_lock);
+}
+
+static void pool_notify(pipeline* p)
+{
+	pthread_mutex_lock(&p->pool_lock);
+	++p->epoch;
+	if (p->sleepers)
+		pthread_cond_broadcast(&p->pool_wake);
+	pthread_mutex_unlock(&p->pool_lock);
+}
+
+static bool pool_finished(pipeline* p)
+{
+	return atomic_load_explicit(&p->loaded_closed, memory_order_acquire)
+		&& !atomic_load_explicit(&p->in_flight, memory_order_acquire);
+}
+
+/* stage 1: queue every regular file under path, false once the loaders are gone */
+static bool walk(pipeline* p, const char* path, bool top)
+{
+	struct stat st;
+
+	/* links are only followed when named on the command line */
+	if ((top ? stat(path, &st) : lstat(path, &st)) != 0) {
+		atomic_fetch_add_explicit(&p->failed, 1, memory_order_relaxed);
+		return true;
+	} //if
+
+	if (S_ISREG(st.st_mode)) {
+		char* copy = strdup(path);
+		if (!copy) {
+			atomic_fetch_add_explicit(&p->failed, 1, memory_order_relaxed);
+			return true;
+		} //if
+
+		if (!queue_push(&p->found, copy)) {
+			free(copy);
+			return false;
+		} //if
+
+		return true;
+	} //if
+
+	if (!S_ISDIR(st.st_mode))
+		return true;
+
+	DIR* dir = opendir(path);
+	if (!dir) {
+		atomic_fetch_add_explicit(&p->failed, 1, memory_order_relaxed);
+		return true;
+	} //if
+
+	size_t len = strlen(path);
+	bool more = true;
+	struct dirent* entry;
+
+	while (more && (entry = readdir(dir))) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+
+		char* child = malloc(len + strlen(entry->d_name) + 2);
+		if (!child) {
+			atomic_fetch_add_explicit(&p->failed, 1, memory_order_relaxed);
+			continue;
+		} //if
+
+		memcpy(child, path, len);
+		child[len] = '/';
+		strcpy(child + len + (len && path[len - 1] != '/'), entry->d_name);
+
+		more = walk(p, child, false);
+		free(child);
+	}
+
+	closedir(dir);
+	return more;
+}
+
+static void* discover(void* arg)
+{
+	pipeline* p = (pipeline*)arg;
+
+	for (size_t i = 0; i < p->path_count && walk(p, p->paths[i], true); i++)
+		;
+
+	queue_close(&p->found);
+	return NULL;
+}
+
+/* stage 2: map ELF files within the budget and read them ahead */
+static void* load(void* arg)
+{
+	pipeline* p = (pipeline*)arg;
+	void* item;
+
+	while (queue_pop(&p->found, &item, true)) {
+		char* path = (char*)item;
+		struct stat st;
+		uint8_t magic[4];
+
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || fstat(fd, &st) != 0) {
+			if (fd >= 0)
+				close(fd);
+			atomic_fetch_add_explicit(&p->failed, 1, memory_order_relaxed);
+			free(path);
+			continue;
+		} //if
+
+		/* most files of a tree are not ELF, look before taking any budget */
+		if (!S_ISREG(st.st_mode) || st.st_size < 64 || pread(fd, magic, 4, 0) != 4 || memcmp(magic, "\x7f" "ELF", 4)) {
+			close(fd);
+			atomic_fetch_add_explicit(&p->skipped, 1, memory_order_relaxed);
+			free(path);
+			continue;
+		} //if
+
+		size_t size = (size_t)st.st_size;
+		budget_acquire(p, size);
+
+		int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		flags |= MAP_POPULATE;
+#endif
+		void* image = mmap(NULL, size, PROT_READ, flags, fd, 0);
+		close(fd);
+
+		pipe_file* file = image != MAP_FAILED ? calloc(1, sizeof(pipe_file)) : NULL;
+		if (!file) {
+			if (image != MAP_FAILED)
+				munmap(image, size);
+			budget_release(p, size);
+			atomic_fetch_add_explicit(&p->failed, 1, memory_order_relaxed);
+			free(path);
+			continue;
+		} //if
+
+#ifndef MAP_POPULATE
+		madvise(image, size, MADV_WILLNEED);
+#endif
+
+		file->path = path;
+		file->image = (uint8_t*)image;
+		file->size = size;
+		atomic_init(&file->pending, 1);
+
+		atomic_fetch_add_explicit(&p->in_flight, 1, memory_order_acq_rel);
+		queue_push(&p->loaded, file);
+		pool_notify(p);
+	}
+
+	/* the last loader tells the pool no more files are coming */
+	if (atomic_fetch_sub_explicit(&p->loaders_live, 1, memory_order_acq_rel) == 1) {
+		queue_close(&p->loaded);
+		atomic_store_explicit(&p->loaded_closed, true, memory_order_release);
+		pool_notify(p);
+	} //if
+
+	return NULL;
+}
+
+static void count_insn(sweep_counts* c, const ldasm_insn* ld, size_t n)
+{
+	++c->insns;
+	if (ld->flags & DF_INVALID) {
+		++c->invalid_insns;
+		c->invalid_bytes += n;
+	} //if
+}
+
+/* speculative sweep of one slice */
+static void sweep_slice(pipe_worker* w, pipe_slice* s, bool is64)
+{
+	const ldasm_tables* tables = w->pipe->tables;
+	sweep_counts c = { 0 };
+	size_t pos = s->begin, consumed;
+	ldasm_insn ld;
+
+	s->head_count = 0;
+	s->truncated = false;
+
+	while (pos < s->end) {
+		size_t n = ldasm_sweep(s->code + pos, s->end - pos, tables, is64, w->out, w->lengths, SWEEP_BATCH, &consumed);
+
+		for (size_t i = 0, at = pos; i < n; at += w->lengths[i++]) {
+			if (s->head_count < HEADS)
+				s->heads[s->head_count++] = (sweep_head){ at, c };
+			count_insn(&c, &w->out[i], w->lengths[i]);
+		}
+
+		pos += consumed;
+		if (n == SWEEP_BATCH || pos >= s->end)
+			continue;
+
+		/* cut off by the slice end, finish it on the rest of the section */
+		n = ldasm_ex(s->code + pos, s->len - pos, tables, &ld, is64);
+		if (n == LDASM_TRUNCATED) {
+			c.invalid_bytes += s->len - pos;
+			s->truncated = true;
+			break;
+		} //if
+
+		if (s->head_count < HEADS)
+			s->heads[s->head_count++] = (sweep_head){ pos, c };
+		count_insn(&c, &ld, n);
+		pos += n;
+	}
+
+	s->stop = pos;
+	s->spec = c;
+}
+
+/* follow the real stream through the slices and add up their counts */
+static void reconcile(pipeline* p, pipe_file* f, sweep_counts* total)
+{
+	size_t at = 0;
+	bool truncated = false;
+	ldasm_insn ld;
+
+	for (size_t i = 0; i < f->slice_count; i++) {
+		const pipe_slice* s = &f->slices[i];
+
+		if (s->first) {
+			total->insns += s->spec.insns;
+			total->invalid_insns += s->spec.invalid_insns;
+			total->invalid_bytes += s->spec.invalid_bytes;
+			at = s->stop;
+			truncated = s->truncated;
+			continue;
+		} //if
+
+		/* the stream ended, or jumped over the whole slice */
+		if (truncated || at >= s->end)
+			continue;
+
+		sweep_counts real = { 0 };
+		size_t pos = at, h = 0;
+		bool synced = false;
+
+		while (pos < s->end) {
+			while (h < s->head_count && s->heads[h].pos < pos)
+				++h;
+			if (h < s->head_count && s->heads[h].pos == pos) {
+				synced = true;
+				break;
+			} //if
+
+			size_t n = ldasm_ex(s->code + pos, s->len - pos, p->tables, &ld, f->index.is64);
+			if (n == LDASM_TRUNCATED) {
+				real.invalid_bytes += s->len - pos;
+				truncated = true;
+				break;
+			} //if
+
+			count_insn(&real, &ld, n);
+			pos += n;
+		}
+
+		total->insns += real.insns;
+		total->invalid_insns += real.invalid_insns;
+		total->invalid_bytes += real.invalid_bytes;
+
+		if (synced) {
+			const sweep_counts* before = &s->heads[h].before;
+			total->insns += s->spec.insns - before->insns;
+			total->invalid_insns += s->spec.invalid_insns - before->invalid_insns;
+			total->invalid_bytes += s->spec.invalid_bytes - before->invalid_bytes;
+			at = s->stop;
+			truncated = s->truncated;
+		}
+		else {
+			at = pos;
+		} //if
+	}
+}
+
+/* stage 4 hand-off: release the file's memory and queue its result for the caller */
+static void finish_file(pipe_worker* w, pipe_file* f)
+{
+	pipeline* p = w->pipe;
+
+	if (f->indexed && !f->failed) {
+		ldasm_pipeline_file* r = &f->result;
+		sweep_counts total = { 0 };
+
+		reconcile(p, f, &total);
+
+		*r = (ldasm_pipeline_file){ .path = f->path, .size = f->size, .is64 = f->index.is64,
+			.sections = f->index.section_count, .insns = total.insns, .invalid_insns = total.invalid_insns,
+			.invalid_bytes = total.invalid_bytes, .functions = f->index.count };
+
+		for (size_t i = 0; i < f->index.section_count; i++)
+			r->code_bytes += f->index.sections[i].size;
+		for (size_t i = 0; i < f->index.count; i++)
+			r->invalid_functions += f->index.funcs[i].invalid != f->index.funcs[i].size;
+	} //if
+
+	ldasm_elf_index_close(&f->index);
+	free(f->slices);
+	f->slices = NULL;
+
+	munmap(f->image, f->size);
+	budget_release(p, f->size);
+
+	queue_push(&p->done, f);
+
+	if (atomic_fetch_sub_explicit(&p->in_flight, 1, memory_order_acq_rel) == 1)
+		pool_notify(p);
+}
+
+static void finish_task(pipe_worker* w, pipe_file* f)
+{
+	if (atomic_fetch_sub_explicit(&f->pending, 1, memory_order_acq_rel) == 1)
+		finish_file(w, f);
+}
+
+/* stage 3a: index the functions of a file, then split its sections into sweep tasks */
+static void index_file(pipe_worker* w, pipe_file* f)
+{
+	pipeline* p = w->pipe;
+	size_t n = 0;
+
+	f->indexed = ldasm_elf_index_build(&f->index, f->image, f->size, p->tables);
+	if (!f->indexed)
+		return;
+
+	for (size_t i = 0; i < f->index.section_count; i++)
+		n += f->index.sections[i].size ? (f->index.sections[i].size + p->slice_size - 1) / p->slice_size : 0;
+
+	f->slices = calloc(n ? n : 1, sizeof(pipe_slice));
+	if (!f->slices) {
+		f->failed = true;
+		return;
+	} //if
+
+	for (size_t i = 0; i < f->index.section_count; i++) {
+		const ldasm_elf_section* sec = &f->index.sections[i];
+		size_t len = (size_t)sec->size;
+		size_t parts = (len + p->slice_size - 1) / p->slice_size;
+
+		for (size_t k = 0; k < parts; k++) {
+			f->slices[f->slice_count++] = (pipe_slice){ .code = f->image + sec->offset, .len = len,
+				.begin = len / parts * k, .end = k + 1 < parts ? len / parts * (k + 1) : len, .first = k == 0 };
+		}
+	}
+
+	/* this task still holds its own count, so the file cannot finish while the slices go out */
+	atomic_fetch_add_explicit(&f->pending, f->slice_count, memory_order_acq_rel);
+
+	for (size_t i = 0; i < f->slice_count; i++) {
+		if (deque_push(&w->deque, (pipe_task){ f, i }))
+			continue;
+
+		/* no room to queue it, sweep it here */
+		sweep_slice(w, &f->slices[i], f->index.is64);
+		finish_task(w, f);
+	}
+
+	if (f->slice_count > 1)
+		pool_notify(p);
+}
+
+static bool next_task(pipe_worker* w, pipe_task* task)
+{
+	pipeline* p = w->pipe;
+	void* item;
+
+	if (deque_pop(&w->deque, task, false))
+		return true;
+
+	for (unsigned k = 1; k < p->worker_count; k++) {
+		pipe_worker* victim = &p->workers[(w->id + k) % p->worker_count];
+		if (deque_pop(&victim->deque, task, true)) {
+			++w->steals;
+			return true;
+		} //if
+	}
+
+	if (queue_pop(&p->loaded, &item, false)) {
+		*task = (pipe_task){ (pipe_file*)item, INDEX_TASK };
+		return true;
+	} //if
+
+	return false;
+}
+
+/* stage 3: decode pool */
+static void* work(void* arg)
+{
+	pipe_worker* w = (pipe_worker*)arg;
+	pipeline* p = w->pipe;
+	pipe_task task;
+
+	for (;;) {
+		pthread_mutex_lock(&p->pool_lock);
+		uint64_t seen = p->epoch;
+		pthread_mutex_unlock(&p->pool_lock);
+
+		if (next_task(w, &task)) {
+			if (task.slice == INDEX_TASK)
+				index_file(w, task.file);
+			else
+				sweep_slice(w, &task.file->slices[task.slice], task.file->index.is64);
+
+			++w->tasks;
+			finish_task(w, task.file);
+			continue;
+		} //if
+
+		if (pool_finished(p))
+			break;
+
+		/* sleep unless work showed up since the queues were looked at */
+		pthread_mutex_lock(&p->pool_lock);
+		if (p->epoch == seen && !pool_finished(p)) {
+			++p->sleepers;
+			pthread_cond_wait(&p->pool_wake, &p->pool_lock);
+			--p->sleepers;
+		} //if
+		pthread_mutex_unlock(&p->pool_lock);
+	}
+
+	if (atomic_fetch_sub_explicit(&p->workers_live, 1, memory_order_acq_rel) == 1)
+		queue_close(&p->done);
+
+	return NULL;
+}
+
+static void destroy(pipeline* p)
+{
+	for (unsigned i = 0; p->workers && i < p->worker_count; i++) {
+		pthread_mutex_destroy(&p->workers[i].deque.lock);
+		free(p->workers[i].deque.tasks);
+		free(p->workers[i].out);
+		free(p->workers[i].lengths);
+	}
+
+	free(p->workers);
+	queue_destroy(&p->found);
+	queue_destroy(&p->loaded);
+	queue_destroy(&p->done);
+	pthread_mutex_destroy(&p->budget_lock);
+	pthread_cond_destroy(&p->budget_freed);
+	pthread_mutex_destroy(&p->pool_lock);
+	pthread_cond_destroy(&p->pool_wake);
+}
+
+bool ldasm_pipeline_run(const char* const* paths, size_t count, const ldasm_tables* tables,
+	const ldasm_pipeline_options* options, ldasm_pipeline_callback callback, void* user, ldasm_pipeline_stats* stats)
+{
+	ldasm_pipeline_options opt = options ? *options : (ldasm_pipeline_options){ 0 };
+	ldasm_pipeline_stats st = { 0 };
+	pipeline p = { 0 };
+	bool ok = true;
+	void* item;
+
+	if (!paths && count)
+		return false;
+
+	unsigned threads = opt.threads ? opt.threads : cpu_count();
+	unsigned loaders = opt.loaders ? opt.loaders : DEFAULT_LOADERS;
+	size_t depth = opt.queue_depth ? opt.queue_depth : DEFAULT_DEPTH;
+
+	p.paths = paths;
+	p.path_count = count;
+	p.tables = tables ? tables : ldasm_default_tables();
+	p.budget = opt.memory_budget ? opt.memory_budget : DEFAULT_BUDGET;
+	p.slice_size = opt.slice_size ? opt.slice_size : DEFAULT_SLICE;
+
+	pthread_mutex_init(&p.budget_lock, NULL);
+	pthread_cond_init(&p.budget_freed, NULL);
+	pthread_mutex_init(&p.pool_lock, NULL);
+	pthread_cond_init(&p.pool_wake, NULL);
+	atomic_init(&p.in_flight, 0);
+	atomic_init(&p.loaded_closed, false);
+	atomic_init(&p.loaders_live, loaders);
+	atomic_init(&p.workers_live, threads);
+	atomic_init(&p.skipped, 0);
+	atomic_init(&p.failed, 0);
+
+	bool queues = queue_init(&p.found, depth);
+	queues = queue_init(&p.loaded, depth) && queues;
+	queues = queue_init(&p.done, depth) && queues;
+	p.workers = queues ? calloc(threads, sizeof(pipe_worker)) : NULL;
+
+	if (!p.workers) {
+		destroy(&p);
+		return false;
+	} //if
+
+	p.worker_count = threads;
+	for (unsigned i = 0; i < threads; i++) {
+		pipe_worker* w = &p.workers[i];
+		w->pipe = &p;
+		w->id = i;
+		pthread_mutex_init(&w->deque.lock, NULL);
+	}
+
+	/* decode workers first, every later stage needs them to drain */
+	unsigned started = 0;
+	for (unsigned i = 0; i < threads; i++) {
+		pipe_worker* w = &p.workers[i];
+		w->out = malloc(SWEEP_BATCH * sizeof(ldasm_insn));
+		w->lengths = malloc(SWEEP_BATCH);
+		w->started = w->out && w->lengths && pthread_create(&w->thread, NULL, work, w) == 0;
+		started += w->started;
+
+		if (!w->started && atomic_fetch_sub_explicit(&p.workers_live, 1, memory_order_acq_rel) == 1)
+			queue_close(&p.done);
+	}
+
+	pthread_t* loader_threads = started ? calloc(loaders, sizeof(pthread_t)) : NULL;
+	bool* loader_started = loader_threads ? calloc(loaders, sizeof(bool)) : NULL;
+	unsigned loaders_started = 0;
+
+	for (unsigned i = 0; i < loaders; i++) {
+		if (loader_started)
+			loader_started[i] = pthread_create(&loader_threads[i], NULL, load, &p) == 0;
+		loaders_started += loader_started && loader_started[i];
+
+		if ((!loader_started || !loader_started[i]) && atomic_fetch_sub_explicit(&p.loaders_live, 1, memory_order_acq_rel) == 1) {
+			queue_close(&p.loaded);
+			atomic_store_explicit(&p.loaded_closed, true, memory_order_release);
+			pool_notify(&p);
+		} //if
+	}
+
+	pthread_t discovery;
+	bool discovering = loaders_started && pthread_create(&discovery, NULL, discover, &p) == 0;
+	if (!discovering) {
+		queue_close(&p.found);
+		ok = false;
+	} //if
+
+	/* stage 4: aggregate on the calling thread */
+	while (started && queue_pop(&p.done, &item, true)) {
+		pipe_file* f = (pipe_file*)item;
+
+		st.bytes += f->size;
+		if (f->failed) {
+			++st.failed;
+		}
+		else if (!f->indexed) {
+			++st.skipped;
+		}
+		else {
+			++st.files;
+			st.code_bytes += f->result.code_bytes;
+			st.insns += f->result.insns;
+			st.invalid_insns += f->result.invalid_insns;
+			st.functions += f->result.functions;
+			st.invalid_functions += f->result.invalid_functions;
+
+			if (callback)
+				callback(&f->result, user);
+		} //if
+
+		free(f->path);
+		free(f);
+	}
+
+	if (discovering)
+		pthread_join(discovery, NULL);
+	for (unsigned i = 0; loader_started && i < loaders; i++) {
+		if (loader_started[i])
+			pthread_join(loader_threads[i], NULL);
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		if (p.workers[i].started)
+			pthread_join(p.workers[i].thread, NULL);
+		st.tasks += p.workers[i].tasks;
+		st.steals += p.workers[i].steals;
+	}
+
+	st.skipped += atomic_load(&p.skipped);
+	st.failed += atomic_load(&p.failed);
+	st.peak_memory = p.peak;
+
+	if (stats)
+		*stats = st;
+
+	free(loader_threads);
+	free(loader_started);
+	destroy(&p);
+
+	return ok && started;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ldasm.h"
+
+typedef struct _ldasm_pipeline_options
+{
+	unsigned threads;           /* decode workers, 0 = one per online CPU */
+	unsigned loaders;           /* threads mapping and reading ahead files, 0 = 2 */
+	size_t   memory_budget;     /* file bytes mapped at once, 0 = 512 MB */
+	size_t   queue_depth;       /* capacity of the queues between stages, 0 = 64 */
+	size_t   slice_size;        /* code bytes per sweep task, 0 = 256 KB */
+} ldasm_pipeline_options;
+
+/* one scanned file, valid during the callback only */
+typedef struct _ldasm_pipeline_file
+{
+	const char* path;
+	uint64_t    size;               /* file size */
+	bool        is64;
+	size_t      sections;           /* executable sections */
+	uint64_t    code_bytes;
+	uint64_t    insns;              /* linear sweep of every executable section, as ldasm-scan counts it */
+	uint64_t    invalid_insns;
+	uint64_t    invalid_bytes;      /* invalid instructions and cut-off instructions at section ends */
+	size_t      functions;
+	size_t      invalid_functions;  /* functions with an invalid or cut-off instruction */
+} ldasm_pipeline_file;
+
+typedef struct _ldasm_pipeline_stats
+{
+	size_t   files;             /* x86 ELF files scanned */
+	size_t   skipped;           /* other files */
+	size_t   failed;            /* files that could not be opened or mapped */
+	uint64_t bytes;             /* file bytes mapped */
+	uint64_t code_bytes;
+	uint64_t insns;
+	uint64_t invalid_insns;
+	size_t   functions;
+	size_t   invalid_functions;
+	size_t   tasks;             /* decode tasks run */
+	size_t   steals;            /* tasks taken from another worker */
+	size_t   peak_memory;       /* most file bytes mapped at once */
+} ldasm_pipeline_stats;
+
+typedef void (*ldasm_pipeline_callback)(const ldasm_pipeline_file* file, void* user);
+
+/**
+ * @brief Scan every ELF file under a list of files and directories
+ *
+ * A discovery thread walks the paths (symbolic links inside directories are not followed), loader
+ * threads map the files and read them ahead, and a work-stealing pool of decode threads indexes
+ * their functions and sweeps their executable sections in slices. The stages are connected by
+ * bounded queues, and loaders wait while the mapped files exceed the memory budget, a file larger
+ * than the budget is mapped alone. The callback runs on the calling thread, once per file, in
+ * completion order.
+ *
+ * @return false if no thread could be started for a stage
+ */
+bool ldasm_pipeline_run(const char* const* paths, size_t count, const ldasm_tables* tables,
+	const ldasm_pipeline_options* options, ldasm_pipeline_callback callback, void* user, ldasm_pipeline_stats* stats);
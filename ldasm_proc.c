@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+
+#include "ldasm_proc.h"
+#include "ldasm_internal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Live-process code access.
+//
+// The executable mappings come from /proc/pid/maps, and code is copied out with process_vm_readv(),
+// so the target keeps running and is never ptrace-stopped. Reads go into one buffer owned by the
+// handle and reused by every call. Measuring many functions packs one I/O vector per function into
+// each call, up to IOV_BATCH of them or a full buffer, so a module costs a handful of syscalls.
+// A vector the kernel cannot read ends the call early; the ones before it are kept, it is skipped
+// or kept partly, and the call is repeated for the rest.
+
+#define DEFAULT_BUFFER (1u << 20)
+#define IOV_BATCH      1024
+#define SIZE_WINDOW    (64u << 10)
+
+static int compare_funcs(const void* a, const void* b)
+{
+	const ldasm_func* x = (const ldasm_func*)a;
+	const ldasm_func* y = (const ldasm_func*)b;
+
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+static bool add_map(ldasm_proc* proc, size_t* cap, const ldasm_proc_map* map)
+{
+	if (proc->count == *cap) {
+		size_t n = *cap ? *cap * 2 : 32;
+		ldasm_proc_map* maps = realloc(proc->maps, n * sizeof(ldasm_proc_map));
+		if (!maps)
+			return false;
+		proc->maps = maps;
+		*cap = n;
+	} //if
+
+	proc->maps[proc->count++] = *map;
+	return true;
+}
+
+bool ldasm_proc_open(ldasm_proc* proc, int pid, size_t buffer_size)
+{
+	char line[4096 + 128];
+	size_t cap = 0;
+
+	if (!proc || pid <= 0)
+		return false;
+
+	memset(proc, 0, sizeof(*proc));
+	proc->pid = pid;
+	proc->buffer_size = buffer_size ? buffer_size : DEFAULT_BUFFER;
+	proc->buffer = malloc(proc->buffer_size);
+
+	snprintf(line, sizeof(line), "/proc/%d/maps", pid);
+	FILE* f = proc->buffer ? fopen(line, "r") : NULL;
+	if (!f) {
+		ldasm_proc_close(proc);
+		return false;
+	} //if
+
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long start, end, offset;
+		char perms[8];
+		int path_at = 0;
+
+		if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms, &offset, &path_at) < 4 || !path_at)
+			continue;
+		if (strlen(perms) < 3 || perms[2] != 'x' || end <= start)
+			continue;
+
+		char* path = line + path_at;
+		path[strcspn(path, "\n")] = '\0';
+
+		ldasm_proc_map map = { .start = start, .end = end, .offset = offset, .path = strdup(path) };
+		if (!map.path || !add_map(proc, &cap, &map)) {
+			free(map.path);
+			fclose(f);
+			ldasm_proc_close(proc);
+			return false;
+		} //if
+	}
+
+	fclose(f);
+	return true;
+}
+
+void ldasm_proc_close(ldasm_proc* proc)
+{
+	if (!proc)
+		return;
+
+	for (size_t i = 0; i < proc->count; i++)
+		free(proc->maps[i].path);
+
+	free(proc->maps);
+	free(proc->buffer);
+	memset(proc, 0, sizeof(*proc));
+}
+
+const ldasm_proc_map* ldasm_proc_find(const ldasm_proc* proc, uint64_t address)
+{
+	size_t lo = 0, hi = proc ? proc->count : 0;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (proc->maps[mid].end <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < (proc ? proc->count : 0) && proc->maps[lo].start <= address ? &proc->maps[lo] : NULL;
+}
+
+/* copy n vectors, got stores the bytes read into each, false if the process cannot be read at all */
+static bool read_vectors(ldasm_proc* proc, struct iovec* local, struct iovec* remote, size_t n, size_t* got)
+{
+	size_t k = 0;
+
+	while (k < n) {
+		ssize_t r = process_vm_readv(proc->pid, local + k, n - k, remote + k, n - k, 0);
+		++proc->syscalls;
+
+		if (r < 0 && errno != EFAULT) {
+			/* gone, or not ours to read */
+			while (k < n)
+				got[k++] = 0;
+			return false;
+		} //if
+
+		if (r <= 0) {
+			/* the first vector is unreadable */
+			got[k++] = 0;
+			continue;
+		} //if
+
+		size_t left = (size_t)r;
+		proc->bytes += left;
+
+		for (; k < n && left >= remote[k].iov_len; k++) {
+			got[k] = remote[k].iov_len;
+			left -= remote[k].iov_len;
+		}
+
+		/* the call stopped inside this vector, the rest of it is unreadable */
+		if (left)
+			got[k++] = left;
+	}
+
+	return true;
+}
+
+const uint8_t* ldasm_proc_read(ldasm_proc* proc, uint64_t address, size_t size, size_t* avail)
+{
+	const ldasm_proc_map* map = ldasm_proc_find(proc, address);
+	size_t got = 0;
+
+	if (avail)
+		*avail = 0;
+
+	if (!map || !size)
+		return NULL;
+
+	if (size > map->end - address)
+		size = (size_t)(map->end - address);
+	if (size > proc->buffer_size)
+		size = proc->buffer_size;
+
+	struct iovec local = { .iov_base = proc->buffer, .iov_len = size };
+	struct iovec remote = { .iov_base = (void*)(uintptr_t)address, .iov_len = size };
+
+	read_vectors(proc, &local, &remote, 1, &got);
+
+	proc->base = address;
+	proc->filled = got;
+
+	if (avail)
+		*avail = got;
+
+	return got ? proc->buffer : NULL;
+}
+
+const uint8_t* ldasm_proc_local(const ldasm_proc* proc, uint64_t address, size_t* avail)
+{
+	if (!proc || address < proc->base || address - proc->base >= proc->filled) {
+		if (avail)
+			*avail = 0;
+		return NULL;
+	} //if
+
+	if (avail)
+		*avail = proc->filled - (size_t)(address - proc->base);
+
+	return proc->buffer + (address - proc->base);
+}
+
+uint64_t ldasm_proc_remote(const ldasm_proc* proc, const uint8_t* p)
+{
+	return proc->base + (uint64_t)(p - proc->buffer);
+}
+
+size_t ldasm_proc_size_of_proc(ldasm_proc* proc, uint64_t address, const ldasm_tables* tables, bool is64)
+{
+	size_t avail, n = LDASM_TRUNCATED;
+	const uint8_t* code = ldasm_proc_local(proc, address, &avail);
+
+	if (!proc)
+		return LDASM_TRUNCATED;
+
+	if (code)
+		n = ldasm_size_of_proc_ex(code, avail, tables, is64);
+
+	/* not in the last read or cut off by its end: read a window from address, then the whole buffer */
+	for (size_t window = SIZE_WINDOW; n == LDASM_TRUNCATED; window = proc->buffer_size) {
+		code = ldasm_proc_read(proc, address, window, &avail);
+		if (!code)
+			return LDASM_TRUNCATED;
+
+		n = ldasm_size_of_proc_ex(code, avail, tables, is64);
+		if (avail < window || window >= proc->buffer_size)
+			break;
+	}
+
+	return n;
+}
+
+bool ldasm_proc_measure(ldasm_proc* proc, ldasm_func* funcs, size_t count, const ldasm_tables* tables, bool is64)
+{
+	struct iovec* local = malloc(IOV_BATCH * (2 * sizeof(struct iovec) + 2 * sizeof(size_t)));
+	if (!proc || !local) {
+		free(local);
+		return false;
+	} //if
+
+	struct iovec* remote = local + IOV_BATCH;
+	size_t* which = (size_t*)(remote + IOV_BATCH);
+	size_t* got = which + IOV_BATCH;
+	bool ok = true;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	for (size_t i = 0; i < count;) {
+		size_t n = 0, used = 0;
+
+		/* as many functions as fit into one call */
+		for (; i < count && n < IOV_BATCH; i++) {
+			ldasm_func* f = &funcs[i];
+			const ldasm_proc_map* map = ldasm_proc_find(proc, f->start);
+
+			if (!map) {
+				f->size = f->invalid = 0;
+				continue;
+			} //if
+
+			/* up to the next function, or the end of the mapping */
+			uint64_t end = map->end;
+			if (i + 1 < count && funcs[i + 1].start > f->start && funcs[i + 1].start < end)
+				end = funcs[i + 1].start;
+			if (f->size && f->start + f->size < end)
+				end = f->start + f->size;
+
+			size_t want = (size_t)(end - f->start);
+			if (want > proc->buffer_size)
+				want = proc->buffer_size;
+			if (used + want > proc->buffer_size)
+				break;
+
+			local[n] = (struct iovec){ .iov_base = proc->buffer + used, .iov_len = want };
+			remote[n] = (struct iovec){ .iov_base = (void*)(uintptr_t)f->start, .iov_len = want };
+			which[n++] = i;
+			used += want;
+		}
+
+		if (!n)
+			continue;
+
+		ok = read_vectors(proc, local, remote, n, got) && ok;
+
+		for (size_t k = 0; k < n; k++) {
+			ldasm_func* f = &funcs[which[k]];
+
+			if (!got[k]) {
+				f->size = f->invalid = 0;
+				continue;
+			} //if
+
+			ldasm_measure_func(f, (const uint8_t*)local[k].iov_base, got[k], remote[k].iov_len, tables, is64);
+		}
+	}
+
+	/* the buffer no longer holds one contiguous read */
+	proc->filled = 0;
+
+	free(local);
+	return ok;
+}
+
+bool ldasm_proc_funcs(ldasm_proc* proc, const ldasm_proc_map* map, const ldasm_tables* tables,
+	ldasm_func** funcs, size_t* count, bool* is64)
+{
+	ldasm_elf_index index;
+	size_t n = 0;
+
+	if (!funcs || !count)
+		return false;
+
+	*funcs = NULL;
+	*count = 0;
+
+	if (!proc || !map || map->path[0] != '/')
+		return false;
+
+	if (!ldasm_elf_index_open(&index, map->path, tables))
+		return false;
+
+	ldasm_func* out = malloc((index.count ? index.count : 1) * sizeof(ldasm_func));
+	if (!out) {
+		ldasm_elf_index_close(&index);
+		return false;
+	} //if
+
+	/* file offsets relate the symbols to the mapping whatever the load bias */
+	for (size_t i = 0; i < index.count; i++) {
+		const uint8_t* code = ldasm_elf_code(&index, index.funcs[i].start, NULL);
+		if (!code)
+			continue;
+
+		uint64_t offset = (uint64_t)(code - index.image);
+		if (offset < map->offset || offset - map->offset >= map->end - map->start)
+			continue;
+
+		/* sizes come from the file, the live code is checked against them */
+		out[n++] = (ldasm_func){ .start = map->start + (offset - map->offset), .size = index.funcs[i].size };
+	}
+
+	if (is64)
+		*is64 = index.is64;
+
+	bool elf64 = index.is64;
+	ldasm_elf_index_close(&index);
+
+	qsort(out, n, sizeof(ldasm_func), compare_funcs);
+
+	*funcs = out;
+	*count = n;
+
+	return ldasm_proc_measure(proc, out, n, tables, elf64);
+}
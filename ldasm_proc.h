@@ -0,0 +1,89 @@
+#pragma once
+
+#include "ldasm_elf.h"
+
+typedef struct _ldasm_proc_map
+{
+	uint64_t start;         /* address in the target */
+	uint64_t end;
+	uint64_t offset;        /* file offset of start */
+	char*    path;          /* backing file, "" for anonymous mappings */
+} ldasm_proc_map;
+
+typedef struct _ldasm_proc
+{
+	int             pid;
+	ldasm_proc_map* maps;           /* executable mappings, sorted by address */
+	size_t          count;
+
+	uint8_t*        buffer;         /* reused by every read */
+	size_t          buffer_size;
+	uint64_t        base;           /* target address of buffer[0] after ldasm_proc_read() */
+	size_t          filled;         /* bytes of the buffer holding target code */
+
+	uint64_t        syscalls;       /* process_vm_readv calls so far */
+	uint64_t        bytes;          /* bytes they copied */
+} ldasm_proc;
+
+/**
+ * @brief Enumerate the executable mappings of a process from /proc/pid/maps
+ *
+ * Code is copied with process_vm_readv(), which needs the same rights as ptrace attach but never
+ * stops the target. buffer_size (0 = 1 MB) bounds every read.
+ */
+bool ldasm_proc_open(ldasm_proc* proc, int pid, size_t buffer_size);
+
+/**
+ * @brief Release the mappings and the buffer
+ */
+void ldasm_proc_close(ldasm_proc* proc);
+
+/**
+ * @brief Executable mapping containing a target address, NULL if none
+ */
+const ldasm_proc_map* ldasm_proc_find(const ldasm_proc* proc, uint64_t address);
+
+/**
+ * @brief Copy up to size bytes of target code from address into the buffer, in one call
+ *
+ * Stops at the end of the mapping and of the buffer.
+ *
+ * @return Pointer to the code in the buffer, NULL if nothing could be read; avail stores how much
+ */
+const uint8_t* ldasm_proc_read(ldasm_proc* proc, uint64_t address, size_t size, size_t* avail);
+
+/**
+ * @brief Translate a target address inside the last read into the buffer, NULL outside it
+ */
+const uint8_t* ldasm_proc_local(const ldasm_proc* proc, uint64_t address, size_t* avail);
+
+/**
+ * @brief Translate a pointer into the buffer back to the target address
+ */
+uint64_t ldasm_proc_remote(const ldasm_proc* proc, const uint8_t* p);
+
+/**
+ * @brief Size of the procedure at a target address, ldasm_size_of_proc_ex() over the live code
+ * @return LDASM_TRUNCATED if the code cannot be read or the procedure runs past what was
+ */
+size_t ldasm_proc_size_of_proc(ldasm_proc* proc, uint64_t address, const ldasm_tables* tables, bool is64);
+
+/**
+ * @brief Measure functions at target addresses like ldasm_elf_index_build() does, on the live code
+ *
+ * funcs must be sorted by start. A size of 0 is measured by decoding, other sizes are kept and
+ * only checked for invalid instructions. Many functions are copied per process_vm_readv() call,
+ * one I/O vector each, as many as fit into the buffer. Functions that cannot be read get size
+ * and invalid 0.
+ */
+bool ldasm_proc_measure(ldasm_proc* proc, ldasm_func* funcs, size_t count, const ldasm_tables* tables, bool is64);
+
+/**
+ * @brief Functions of the ELF file behind a mapping, at their target addresses and measured on the live code
+ *
+ * Only symbols whose code lies in this mapping are taken. The file is read from disk to find
+ * them and their sizes, invalid is found on the code of the process, so patched or hooked
+ * functions show up. funcs is allocated with malloc().
+ */
+bool ldasm_proc_funcs(ldasm_proc* proc, const ldasm_proc_map* map, const ldasm_tables* tables,
+	ldasm_func** funcs, size_t* count, bool* is64);
@@ -0,0 +1,399 @@
+#include "ldasm_internal.h"
+
+#include <string.h>
+
+// Instruction relocation for hook trampolines.
+//
+// Whole instructions covering at least min_bytes are copied from src to a block that will run
+// at dst_addr. Branches and RIP-relative operands are re-targeted for the new address: rel8
+// branches are widened to rel32, targets out of rel32 reach get absolute forms, and branches
+// into the copied range are pointed at the copy. The instructions are kept in a small array on
+// the stack and the block is laid out in two passes, nothing is allocated.
+
+#define MAX_INSNS    32
+#define MAX_OUT      32
+#define REACH_MARGIN 4096  /* the block is far smaller, so forms can be chosen against dst_addr */
+
+enum reloc_kind
+{
+	RK_COPY,    /* no address operand */
+	RK_JCC,     /* 70-7F, 0F 80-8F */
+	RK_JMP,     /* EB, E9 */
+	RK_CALL,    /* E8 */
+	RK_LOOP,    /* E0-E3, no rel32 form exists */
+	RK_XBEGIN,  /* C7 F8 rel32 */
+	RK_RIP      /* RIP-relative ModR/M operand */
+};
+
+typedef struct _reloc_insn
+{
+	ldasm_insn ld;
+	size_t     offset;   /* offset in src */
+	size_t     size;
+	size_t     out;      /* offset in dst */
+	uint64_t   target;   /* branch target or RIP-relative address */
+	int        kind;
+	int        inside;   /* index of the copied instruction the branch targets, -1 if none */
+} reloc_insn;
+
+static inline void put32(uint8_t* b, uint32_t v)
+{
+	memcpy(b, &v, sizeof(v));
+}
+
+static inline void put64(uint8_t* b, uint64_t v)
+{
+	memcpy(b, &v, sizeof(v));
+}
+
+static inline bool fits_rel32(uint64_t next, uint64_t target, bool is64)
+{
+	int64_t delta = (int64_t)(target - next);
+	return !is64 || (delta >= INT32_MIN && delta <= INT32_MAX);
+}
+
+/* target is in rel32 reach from anywhere in the block at dst_addr */
+static inline bool near_block(uint64_t dst_addr, uint64_t target, bool is64)
+{
+	int64_t delta = (int64_t)(target - dst_addr);
+	return !is64 || (delta > INT32_MIN + REACH_MARGIN && delta < INT32_MAX - REACH_MARGIN);
+}
+
+/* legacy prefixes end where REX, VEX or the opcode starts */
+static inline size_t prefix_size(const ldasm_insn* ld)
+{
+	if (ld->vex_size)
+		return ld->vex_offset;
+	return ld->opcd_offset - ((ld->flags & DF_REX) ? 1u : 0u);
+}
+
+static bool has_prefix(const uint8_t* p, const ldasm_insn* ld, uint8_t prefix)
+{
+	return memchr(p, prefix, prefix_size(ld)) != NULL;
+}
+
+/* jmp rel32, or jmp [rip+0] followed by the 64-bit target */
+static size_t emit_jmp(uint8_t* b, uint64_t at, uint64_t target, bool absolute)
+{
+	if (!absolute) {
+		b[0] = 0xE9;
+		put32(b + 1, (uint32_t)(target - (at + 5)));
+		return 5;
+	} //if
+
+	b[0] = 0xFF;
+	b[1] = 0x25;
+	put32(b + 2, 0);
+	put64(b + 6, target);
+	return 14;
+}
+
+/* RIP-relative operand out of rel32 reach, only forms that need no scratch register */
+static size_t emit_rip_far(uint8_t* b, const uint8_t* p, const reloc_insn* r)
+{
+	const ldasm_insn* ld = &r->ld;
+	const uint8_t op = p[ld->opcd_offset];
+	const uint8_t ro = (ld->modrm >> 3) & 7;
+	const uint8_t reg = (uint8_t)((((ld->rex >> 2) & 1) << 3) | ro);
+	size_t n = 0;
+
+	if (ld->vex_size || ld->opcd_size != 1 || has_prefix(p, ld, 0x67))
+		return 0;
+
+	/* lea r, [rip+disp] becomes mov r, imm */
+	if (op == 0x8D) {
+		if (has_prefix(p, ld, 0x66))
+			return 0;
+		if (ld->rex & 8) {
+			b[n++] = (uint8_t)(0x48 | (reg >> 3));
+			b[n++] = (uint8_t)(0xB8 + (reg & 7));
+			put64(b + n, r->target);
+			return n + 8;
+		} //if
+		if (reg & 8)
+			b[n++] = 0x41;
+		b[n++] = (uint8_t)(0xB8 + (reg & 7));
+		put32(b + n, (uint32_t)r->target);
+		return n + 4;
+	} //if
+
+	/* mov r, [rip+disp] / movsxd r, [rip+disp]: load the address into r, then read through it;
+	 * not for 16-bit loads, they keep the upper bits of r the address would be left in */
+	if ((op == 0x8B || op == 0x63) && (reg & 7) != 4 && !has_prefix(p, ld, 0x66)) {
+		b[n++] = (uint8_t)(0x48 | (reg >> 3));
+		b[n++] = (uint8_t)(0xB8 + (reg & 7));
+		put64(b + n, r->target);
+		n += 8;
+
+		size_t pfx = prefix_size(ld);
+		memcpy(b + n, p, pfx);
+		n += pfx;
+		if (ld->flags & DF_REX)
+			b[n++] = (uint8_t)((ld->rex & ~3u) | (reg >> 3));
+		b[n++] = op;
+
+		/* [r], rbp/r13 as base needs mod 1 with a zero disp8 */
+		if ((reg & 7) == 5) {
+			b[n++] = (uint8_t)(0x40 | (ro << 3) | 5);
+			b[n++] = 0;
+		}
+		else {
+			b[n++] = (uint8_t)((ro << 3) | (reg & 7));
+		} //if
+		return n;
+	} //if
+
+	/* jmp [rip+disp]: push rax; mov rax, imm64; mov rax, [rax]; xchg [rsp], rax; ret */
+	if (op == 0xFF && ro == 4 && !prefix_size(ld) && !(ld->flags & DF_REX)) {
+		static const uint8_t tail[] = { 0x48, 0x8B, 0x00, 0x48, 0x87, 0x04, 0x24, 0xC3 };
+		b[n++] = 0x50;
+		b[n++] = 0x48;
+		b[n++] = 0xB8;
+		put64(b + n, r->target);
+		n += 8;
+		memcpy(b + n, tail, sizeof(tail));
+		return n + sizeof(tail);
+	} //if
+
+	return 0;
+}
+
+/* write one relocated instruction running at address at, return its size or 0 if impossible */
+static size_t emit(uint8_t* b, const uint8_t* p, const reloc_insn* r, uint64_t at, uint64_t target, bool near)
+{
+	const ldasm_insn* ld = &r->ld;
+	const uint8_t op = p[ld->opcd_offset + ld->opcd_size - 1];
+	size_t n = 0;
+
+	switch (r->kind) {
+	case RK_COPY:
+		memcpy(b, p, r->size);
+		return r->size;
+
+	case RK_JCC:
+		if (near) {
+			b[0] = 0x0F;
+			b[1] = (uint8_t)(0x80 | (op & 0x0F));
+			put32(b + 2, (uint32_t)(target - (at + 6)));
+			return 6;
+		} //if
+		/* inverted short jcc over an absolute jmp */
+		b[0] = (uint8_t)(0x70 | ((op & 0x0F) ^ 1));
+		b[1] = 14;
+		return 2 + emit_jmp(b + 2, at + 2, target, true);
+
+	case RK_JMP:
+		return emit_jmp(b, at, target, !near);
+
+	case RK_CALL:
+		if (near) {
+			b[0] = 0xE8;
+			put32(b + 1, (uint32_t)(target - (at + 5)));
+			return 5;
+		} //if
+		/* call [rip+2]; jmp +8; dq target */
+		b[0] = 0xFF;
+		b[1] = 0x15;
+		put32(b + 2, 2);
+		b[6] = 0xEB;
+		b[7] = 8;
+		put64(b + 8, target);
+		return 16;
+
+	case RK_LOOP:
+		/* loop +2; jmp over; jmp target */
+		n = prefix_size(ld);
+		memcpy(b, p, n);
+		b[n++] = op;
+		b[n++] = 2;
+		b[n++] = 0xEB;
+		b[n++] = near ? 5 : 14;
+		return n + emit_jmp(b + n, at + n, target, !near);
+
+	case RK_XBEGIN:
+		if (!near)
+			return 0;
+		memcpy(b, p, r->size);
+		put32(b + ld->imm_offset, (uint32_t)(target - (at + r->size)));
+		return r->size;
+
+	case RK_RIP:
+		if (!near)
+			return emit_rip_far(b, p, r);
+		memcpy(b, p, r->size);
+		put32(b + ld->disp_offset, (uint32_t)(target - (at + r->size)));
+		return r->size;
+	}
+
+	return 0;
+}
+
+/* sort an instruction into its relocation kind, false if it cannot be relocated */
+static bool classify(reloc_insn* r, const uint8_t* p, uint64_t ip, bool is64)
+{
+	const ldasm_insn* ld = &r->ld;
+	const uint8_t op = p[ld->opcd_offset + ld->opcd_size - 1];
+	uint64_t next = ip + r->size;
+
+	r->kind = RK_COPY;
+	r->inside = -1;
+
+	if (!(ld->flags & DF_RELATIVE)) {
+		/* xbegin carries a rel32 the tables do not mark, rel16 is refused like other branches */
+		if (!ld->vex_size && ld->opcd_size == 1 && op == 0xC7 && ld->modrm == 0xF8) {
+			if (ld->imm_size != 4)
+				return false;
+
+			int32_t rel;
+			memcpy(&rel, p + ld->imm_offset, sizeof(rel));
+			r->kind = RK_XBEGIN;
+			r->target = next + (uint64_t)(int64_t)rel;
+		} //if
+		return true;
+	} //if
+
+	if (ld->flags & DF_DISP) {
+		int32_t disp;
+		if (ld->disp_size != 4 || has_prefix(p, ld, 0x67))
+			return false;
+		memcpy(&disp, p + ld->disp_offset, sizeof(disp));
+		r->kind = RK_RIP;
+		r->target = next + (uint64_t)(int64_t)disp;
+		return true;
+	} //if
+
+	/* rel16 (operand size prefix) branches are not relocated */
+	if (ld->imm_size == 1)
+		r->target = next + (uint64_t)(int64_t)(int8_t)p[ld->imm_offset];
+	else if (ld->imm_size == 4) {
+		int32_t rel;
+		memcpy(&rel, p + ld->imm_offset, sizeof(rel));
+		r->target = next + (uint64_t)(int64_t)rel;
+	}
+	else {
+		return false;
+	} //if
+
+	if (!is64)
+		r->target &= 0xFFFFFFFFu;
+
+	if (ld->opcd_size == 2 && op >= 0x80 && op <= 0x8F)
+		r->kind = RK_JCC;
+	else if (ld->opcd_size != 1)
+		return false;
+	else if (op >= 0x70 && op <= 0x7F)
+		r->kind = RK_JCC;
+	else if (op >= 0xE0 && op <= 0xE3)
+		r->kind = RK_LOOP;
+	else if (op == 0xE8)
+		r->kind = RK_CALL;
+	else if (op == 0xE9 || op == 0xEB)
+		r->kind = RK_JMP;
+	else
+		return false;
+
+	return true;
+}
+
+size_t ldasm_relocate(const void* src, size_t min_bytes, void* dst, size_t dst_cap, uint64_t dst_addr,
+	const ldasm_tables* tables, bool is64, size_t* copied)
+{
+	const uint8_t* p = (const uint8_t*)src;
+	const uint64_t src_addr = (uint64_t)(uintptr_t)src;
+	reloc_insn insns[MAX_INSNS];
+	uint8_t buf[MAX_OUT];
+	size_t count = 0, pos = 0, out = 0;
+
+	if (copied)
+		*copied = 0;
+
+	if (!p || !dst)
+		return 0;
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+	if (!is64)
+		dst_addr &= 0xFFFFFFFFu;
+
+	/* pass 1: decode and classify whole instructions covering min_bytes */
+	while (pos < min_bytes) {
+		if (count == MAX_INSNS)
+			return 0;
+
+		reloc_insn* r = &insns[count];
+		r->offset = pos;
+		r->size = ldasm(p + pos, tables, &r->ld, is64);
+		if (!r->size || (r->ld.flags & DF_INVALID))
+			return 0;
+		if (!classify(r, p + pos, src_addr + pos, is64))
+			return 0;
+
+		pos += r->size;
+		++count;
+	}
+
+	/* pass 2: branches into the copied range must hit an instruction start, then lay out the block */
+	for (size_t i = 0; i < count; i++) {
+		reloc_insn* r = &insns[i];
+
+		if (r->kind != RK_COPY && r->kind != RK_RIP && r->target - src_addr < pos) {
+			for (size_t j = 0; j < count && r->inside < 0; j++) {
+				if (insns[j].offset == r->target - src_addr)
+					r->inside = (int)j;
+			}
+			if (r->inside < 0)
+				return 0;
+		} //if
+
+		bool near = r->inside >= 0 || near_block(dst_addr, r->target, is64);
+		size_t n = emit(buf, p + r->offset, r, dst_addr + out, r->inside >= 0 ? dst_addr : r->target, near);
+		if (!n)
+			return 0;
+
+		r->out = out;
+		out += n;
+	}
+
+	if (out > dst_cap)
+		return 0;
+
+	/* pass 3: emit with the final addresses */
+	for (size_t i = 0; i < count; i++) {
+		const reloc_insn* r = &insns[i];
+		size_t next = i + 1 < count ? insns[i + 1].out : out;
+		uint64_t at = dst_addr + r->out;
+		uint64_t target = r->inside >= 0 ? dst_addr + insns[r->inside].out : r->target;
+		bool near = r->inside >= 0 || near_block(dst_addr, r->target, is64);
+
+		if (emit(buf, p + r->offset, r, at, target, near) != next - r->out)
+			return 0;
+
+		memcpy((uint8_t*)dst + r->out, buf, next - r->out);
+	}
+
+	if (copied)
+		*copied = pos;
+
+	return out;
+}
+
+size_t ldasm_write_jmp(void* dst, size_t dst_cap, uint64_t dst_addr, uint64_t target, bool is64)
+{
+	uint8_t buf[14];
+
+	if (!dst)
+		return 0;
+
+	if (!is64) {
+		dst_addr &= 0xFFFFFFFFu;
+		target &= 0xFFFFFFFFu;
+	} //if
+
+	size_t n = emit_jmp(buf, dst_addr, target, !fits_rel32(dst_addr + 5, target, is64));
+	if (n > dst_cap)
+		return 0;
+
+	memcpy(dst, buf, n);
+	return n;
+}
@@ -0,0 +1,539 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ldasm.h"
+#include "ldasm_elf.h"
+#include "ldasm_verify.h"
+#include "ldasm_stats.h"
+#include "ldasm_xref.h"
+#include "ldasm_sig.h"
+#include "ldasm_bounds.h"
+#include "ldasm_proc.h"
+#include "ldasm_pipeline.h"
+
+// ldasm-scan: triage an ELF file or a raw code blob.
+//
+// usage: ldasm-scan [options] file
+//        ldasm-scan --pid PID
+//        ldasm-scan --tree [--jobs N] [--budget MB] path...
+//        ldasm-scan --verify [--objdump]
+//   --raw         treat the file as raw code even if it is an ELF image
+//   --32          decode raw input as 32-bit code (default 64-bit)
+//   --hugepages   ask for transparent huge pages on the mapping
+//   --funcs       print every function of an ELF file: address, size, first invalid offset
+//   --stats       print the decoder counters of the scan (library built with -DLDASM_STATS)
+//   --xrefs       extract branch targets and RIP-relative references, print the most referenced
+//   --bounds      index the instruction starts of every section, count functions starting off them
+//   --sig PATTERN print where a byte signature like "48 8B 05 ?? ?? ?? ??" starts an instruction,
+//                 may be repeated, all signatures are matched in one pass
+//   --pid PID     measure the functions of every file-backed executable mapping of a running
+//                 process from its live code, without stopping it
+//   --tree        scan every ELF file under the paths, files and directories, in a pipeline of
+//                 loader and decode threads, one line per file
+//   --jobs N      decode threads of --tree (default one per CPU)
+//   --budget MB   file bytes --tree keeps mapped at once (default 512)
+//   --verify      check all decoder paths against ldasm() over the whole encoding space
+//   --objdump     with --verify, also compare lengths against objdump
+//
+// The file is mapped read-only and decoded in place, nothing is copied to the heap.
+
+#define BATCH 65536
+
+typedef struct _scan_stats
+{
+	size_t bytes;
+	size_t insns;
+	size_t invalid_insns;
+	size_t invalid_bytes;
+} scan_stats;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void scan_region(const uint8_t* code, size_t len, bool is64, ldasm_insn* out, uint8_t* lengths, scan_stats* st)
+{
+	size_t pos = 0, consumed;
+
+	while (pos < len) {
+		size_t n = ldasm_sweep(code + pos, len - pos, NULL, is64, out, lengths, BATCH, &consumed);
+
+		for (size_t i = 0; i < n; i++) {
+			if (out[i].flags & DF_INVALID) {
+				++st->invalid_insns;
+				st->invalid_bytes += lengths[i];
+			} //if
+		}
+
+		st->insns += n;
+		pos += consumed;
+
+		/* truncated instruction at the end of the region */
+		if (n < BATCH) {
+			st->invalid_bytes += len - pos;
+			break;
+		} //if
+	}
+
+	st->bytes += len;
+}
+
+/* the most frequent opcodes of a histogram */
+static void print_top(const char* name, const uint64_t* histogram, uint64_t total)
+{
+	uint8_t order[256];
+
+	for (size_t i = 0; i < 256; i++)
+		order[i] = (uint8_t)i;
+
+	printf("%-16s", name);
+	for (size_t k = 0; k < 8 && total; k++) {
+		for (size_t i = k + 1; i < 256; i++) {
+			if (histogram[order[i]] > histogram[order[k]]) {
+				uint8_t tmp = order[k];
+				order[k] = order[i];
+				order[i] = tmp;
+			} //if
+		}
+		if (!histogram[order[k]])
+			break;
+		printf(" %02X:%.1f%%", order[k], 100.0 * (double)histogram[order[k]] / (double)total);
+	}
+	printf("\n");
+}
+
+static void print_stats(void)
+{
+	ldasm_stats st;
+
+	if (!ldasm_stats_enabled()) {
+		printf("decoder stats:   not built with LDASM_STATS\n");
+		return;
+	} //if
+
+	ldasm_stats_snapshot(&st, true);
+
+	double n = st.decodes ? (double)st.decodes : 1.0;
+	printf("decodes:         %llu (%llu truncated, %llu invalid)\n", (unsigned long long)st.decodes,
+		(unsigned long long)st.truncated, (unsigned long long)st.invalid);
+	printf("per decode:      %.2f bytes, %.2f prefix bytes, rex %.1f%%\n",
+		(double)st.bytes / n, (double)st.prefix_bytes / n, 100.0 * (double)st.rex / n);
+	printf("opcode maps:     0F %.1f%%, 0F 38/3A %.1f%%, VEX/EVEX/XOP %.1f%%\n",
+		100.0 * (double)st.two_byte / n, 100.0 * (double)st.three_byte / n, 100.0 * (double)st.vex / n);
+	printf("operands:        modrm %.1f%%, sib %.1f%%, disp %.1f%%, imm %.1f%%\n",
+		100.0 * (double)st.modrm / n, 100.0 * (double)st.sib / n, 100.0 * (double)st.disp / n, 100.0 * (double)st.imm / n);
+	print_top("top opcodes:", st.opcode, st.decodes);
+	print_top("top 0F opcodes:", st.opcode_0f, st.two_byte);
+	print_top("top VEX opcodes:", st.opcode_vex, st.vex);
+}
+
+static void print_xrefs(const ldasm_xrefs* xrefs, double t)
+{
+	static const char* const kinds[] = { "call", "jmp", "jcc", "data", "addr" };
+	size_t per_kind[5] = { 0 }, targets = 0;
+	uint64_t top[8] = { 0 };
+	size_t top_count[8] = { 0 };
+
+	for (size_t i = 0; i < xrefs->count; i++)
+		++per_kind[xrefs->refs[i].kind];
+
+	/* walk the inverse index one target at a time */
+	for (size_t i = 0; i < xrefs->count;) {
+		uint64_t target = xrefs->refs[xrefs->by_target[i]].target;
+		size_t n;
+
+		ldasm_xrefs_to(xrefs, target, &n);
+		++targets;
+		i += n;
+
+		for (size_t k = 0; k < 8; k++) {
+			if (n > top_count[k]) {
+				memmove(&top[k + 1], &top[k], (7 - k) * sizeof(top[0]));
+				memmove(&top_count[k + 1], &top_count[k], (7 - k) * sizeof(top_count[0]));
+				top[k] = target;
+				top_count[k] = n;
+				break;
+			} //if
+		}
+	}
+
+	printf("xrefs:           %zu to %zu targets in %.3f s\n", xrefs->count, targets, t);
+	printf("by kind:        ");
+	for (size_t k = 0; k < 5; k++)
+		printf(" %s %zu", kinds[k], per_kind[k]);
+	printf("\n");
+
+	for (size_t k = 0; k < 8 && top_count[k]; k++)
+		printf("%016llx %8zu references\n", (unsigned long long)top[k], top_count[k]);
+}
+
+/* match the signatures over one region loaded at addr, print the first matches */
+static size_t scan_sigs(const ldasm_sigset* set, const uint8_t* code, size_t len, uint64_t addr, bool is64)
+{
+	ldasm_sig_match matches[64];
+	size_t n = ldasm_sigset_scan(set, code, len, NULL, is64, matches, 64);
+
+	for (size_t i = 0; i < n && i < 64; i++)
+		printf("%016llx sig %u\n", (unsigned long long)(addr + matches[i].offset), matches[i].sig);
+	if (n > 64)
+		printf("... %zu more\n", n - 64);
+
+	return n;
+}
+
+/* measure the functions of a live process, mapping by mapping */
+static int scan_process(int pid)
+{
+	ldasm_proc proc;
+	size_t total = 0, bad = 0, scanned = 0;
+
+	if (!ldasm_proc_open(&proc, pid, 0)) {
+		fprintf(stderr, "cannot read the mappings of %d\n", pid);
+		return 1;
+	} //if
+
+	double t = now_sec();
+
+	for (size_t i = 0; i < proc.count; i++) {
+		const ldasm_proc_map* map = &proc.maps[i];
+		ldasm_func* funcs = NULL;
+		size_t count = 0, invalid = 0;
+		bool is64;
+
+		if (!ldasm_proc_funcs(&proc, map, NULL, &funcs, &count, &is64)) {
+			if (count)
+				fprintf(stderr, "cannot read the code of %d\n", pid);
+			free(funcs);
+			continue;
+		} //if
+
+		for (size_t k = 0; k < count; k++)
+			invalid += funcs[k].invalid != funcs[k].size;
+
+		printf("%016llx-%016llx %8zu functions %6zu with invalid code  %s\n", (unsigned long long)map->start,
+			(unsigned long long)map->end, count, invalid, map->path);
+
+		total += count;
+		bad += invalid;
+		++scanned;
+		free(funcs);
+	}
+
+	t = now_sec() - t;
+
+	printf("process:         %d, %zu executable mappings, %zu with symbols\n", pid, proc.count, scanned);
+	printf("functions:       %zu (%zu with invalid code)\n", total, bad);
+	printf("copied:          %llu bytes in %llu process_vm_readv calls, %.3f s\n", (unsigned long long)proc.bytes,
+		(unsigned long long)proc.syscalls, t);
+
+	ldasm_proc_close(&proc);
+	return 0;
+}
+
+static void print_file(const ldasm_pipeline_file* file, void* user)
+{
+	(void)user;
+	printf("%10llu insns %6llu invalid %6zu functions %4zu invalid  %s\n", (unsigned long long)file->insns,
+		(unsigned long long)file->invalid_insns, file->functions, file->invalid_functions, file->path);
+}
+
+/* scan whole directory trees in the pipeline */
+static int scan_tree(const char* const* paths, size_t count, const ldasm_pipeline_options* options)
+{
+	ldasm_pipeline_stats st;
+	double t = now_sec();
+
+	if (!ldasm_pipeline_run(paths, count, NULL, options, print_file, NULL, &st)) {
+		fprintf(stderr, "cannot start the pipeline\n");
+		return 1;
+	} //if
+
+	t = now_sec() - t;
+
+	printf("files:           %zu ELF, %zu skipped, %zu failed\n", st.files, st.skipped, st.failed);
+	printf("instructions:    %llu (%llu invalid) in %llu code bytes\n", (unsigned long long)st.insns,
+		(unsigned long long)st.invalid_insns, (unsigned long long)st.code_bytes);
+	printf("functions:       %zu (%zu with invalid code)\n", st.functions, st.invalid_functions);
+	printf("tasks:           %zu, %zu stolen, peak %.1f MB mapped\n", st.tasks, st.steals, (double)st.peak_memory / 1048576.0);
+	printf("throughput:      %.1f MB/s mapped, %.1f MB/s code, %.3f s\n", (double)st.bytes / 1048576.0 / t,
+		(double)st.code_bytes / 1048576.0 / t, t);
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: ldasm-scan [--raw] [--32] [--hugepages] [--funcs] [--stats] [--xrefs] [--bounds] [--sig PATTERN]... file\n");
+	fprintf(stderr, "       ldasm-scan --pid PID\n");
+	fprintf(stderr, "       ldasm-scan --tree [--jobs N] [--budget MB] path...\n");
+	fprintf(stderr, "       ldasm-scan --verify [--objdump]\n");
+}
+
+/* a whole decimal number no larger than max */
+static bool parse_number(const char* s, unsigned long max, unsigned long* value)
+{
+	char* end;
+
+	errno = 0;
+	unsigned long v = strtoul(s, &end, 10);
+	if (!isdigit((unsigned char)*s) || *end || errno || v > max)
+		return false;
+
+	*value = v;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	bool raw = false, is64 = true, hugepages = false, funcs = false, verify = false, objdump = false, stats = false;
+	bool xref = false, bounds = false, tree = false;
+	const char* path = NULL;
+	const char** paths = calloc(argc, sizeof(char*));
+	size_t path_count = 0;
+	ldasm_pipeline_options pipe = { 0 };
+	ldasm_sigset sigs = { 0 };
+	int pid = 0;
+	unsigned long number;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--raw"))
+			raw = true;
+		else if (!strcmp(argv[i], "--32"))
+			is64 = false;
+		else if (!strcmp(argv[i], "--hugepages"))
+			hugepages = true;
+		else if (!strcmp(argv[i], "--funcs"))
+			funcs = true;
+		else if (!strcmp(argv[i], "--stats"))
+			stats = true;
+		else if (!strcmp(argv[i], "--xrefs"))
+			xref = true;
+		else if (!strcmp(argv[i], "--bounds"))
+			bounds = true;
+		else if (!strcmp(argv[i], "--sig") && i + 1 < argc) {
+			if (ldasm_sigset_add(&sigs, argv[++i]) < 0) {
+				fprintf(stderr, "bad signature %s\n", argv[i]);
+				free(paths);
+				return 2;
+			} //if
+		}
+		else if (!strcmp(argv[i], "--pid") && i + 1 < argc)
+			pid = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--tree"))
+			tree = true;
+		else if (!strcmp(argv[i], "--jobs") && i + 1 < argc && parse_number(argv[i + 1], UINT_MAX, &number)) {
+			pipe.threads = (unsigned)number;
+			++i;
+		}
+		else if (!strcmp(argv[i], "--budget") && i + 1 < argc && parse_number(argv[i + 1], SIZE_MAX >> 20, &number)) {
+			pipe.memory_budget = (size_t)number << 20;
+			++i;
+		}
+		else if (!strcmp(argv[i], "--verify"))
+			verify = true;
+		else if (!strcmp(argv[i], "--objdump"))
+			objdump = true;
+		else if (argv[i][0] != '-' && paths && (tree || !path_count))
+			path = paths[path_count++] = argv[i];
+		else {
+			usage();
+			free(paths);
+			return 2;
+		} //if
+	}
+
+	/* paths only feed the tree scan, path points into argv */
+	int status = -1;
+	if (verify)
+		status = ldasm_verify(objdump, 20);
+	else if (pid)
+		status = scan_process(pid);
+	else if (tree && path_count)
+		status = scan_tree(paths, path_count, &pipe);
+
+	free(paths);
+	if (status >= 0)
+		return status;
+
+	if (!path) {
+		usage();
+		return 2;
+	} //if
+
+	int fd = open(path, O_RDONLY);
+	struct stat sb;
+	if (fd < 0 || fstat(fd, &sb) != 0 || sb.st_size <= 0) {
+		fprintf(stderr, "cannot open %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	} //if
+
+	size_t size = (size_t)sb.st_size;
+	uint8_t* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "cannot map %s\n", path);
+		return 1;
+	} //if
+
+	madvise(image, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	if (hugepages)
+		madvise(image, size, MADV_HUGEPAGE);
+#else
+	(void)hugepages;
+#endif
+
+	ldasm_insn* out = malloc(BATCH * sizeof(ldasm_insn));
+	uint8_t* lengths = malloc(BATCH);
+	if (!out || !lengths)
+		return 1;
+
+	scan_stats st = { 0 };
+	ldasm_elf_index index;
+	bool elf = !raw && ldasm_elf_index_build(&index, image, size, NULL);
+
+	ldasm_stats_reset(true);
+	double t = now_sec();
+
+	if (elf) {
+		is64 = index.is64;
+		for (size_t i = 0; i < index.section_count; i++)
+			scan_region(image + index.sections[i].offset, (size_t)index.sections[i].size, is64, out, lengths, &st);
+	}
+	else {
+		scan_region(image, size, is64, out, lengths, &st);
+	} //if
+
+	t = now_sec() - t;
+
+	printf("file:            %s (%s, %s)\n", path, elf ? "elf" : "raw", is64 ? "x86-64" : "x86");
+	printf("code bytes:      %zu\n", st.bytes);
+	printf("instructions:    %zu\n", st.insns);
+	printf("invalid insns:   %zu\n", st.invalid_insns);
+	printf("invalid bytes:   %zu\n", st.invalid_bytes);
+	printf("throughput:      %.1f MB/s\n", t > 0 ? (double)st.bytes / t / 1e6 : 0.0);
+
+	if (stats)
+		print_stats();
+
+	if (xref) {
+		ldasm_xrefs xrefs = { 0 };
+		bool ok = true;
+
+		t = now_sec();
+		if (elf) {
+			for (size_t i = 0; ok && i < index.section_count; i++) {
+				const ldasm_elf_section* sec = &index.sections[i];
+				ok = ldasm_xrefs_scan(&xrefs, image + sec->offset, (size_t)sec->size, sec->addr, NULL, is64);
+			}
+		}
+		else {
+			ok = ldasm_xrefs_scan(&xrefs, image, size, 0, NULL, is64);
+		} //if
+		ok = ok && ldasm_xrefs_finish(&xrefs);
+		t = now_sec() - t;
+
+		if (ok)
+			print_xrefs(&xrefs, t);
+		else
+			fprintf(stderr, "out of memory extracting xrefs\n");
+
+		ldasm_xrefs_free(&xrefs);
+	} //if
+
+	if (bounds && elf) {
+		ldasm_bounds* index_bounds = calloc(index.section_count, sizeof(ldasm_bounds));
+		size_t bytes = 0, code = 0, off = 0;
+		bool ok = index_bounds != NULL;
+
+		t = now_sec();
+		for (size_t i = 0; ok && i < index.section_count; i++) {
+			const ldasm_elf_section* sec = &index.sections[i];
+			ok = ldasm_bounds_build(&index_bounds[i], image + sec->offset, (size_t)sec->size, sec->addr, NULL, is64, 0);
+			bytes += ldasm_bounds_bytes(&index_bounds[i]);
+			code += (size_t)sec->size;
+		}
+		t = now_sec() - t;
+
+		/* functions the linear sweep runs past, usually after data in the code */
+		for (size_t i = 0; ok && i < index.count; i++) {
+			bool start = false;
+			for (size_t k = 0; !start && k < index.section_count; k++)
+				start = ldasm_bounds_is_start(&index_bounds[k], index.funcs[i].start);
+			off += !start;
+		}
+
+		if (ok)
+			printf("bounds:          %zu bytes for %zu code bytes in %.3f s, %zu functions off the sweep\n", bytes, code, t, off);
+		else
+			fprintf(stderr, "out of memory indexing instruction starts\n");
+
+		for (size_t i = 0; index_bounds && i < index.section_count; i++)
+			ldasm_bounds_free(&index_bounds[i]);
+		free(index_bounds);
+	} //if
+
+	if (sigs.count) {
+		size_t found = 0;
+
+		t = now_sec();
+		if (elf) {
+			/* byte frequencies of the largest section, mostly .text */
+			const ldasm_elf_section* big = NULL;
+			for (size_t i = 0; i < index.section_count; i++) {
+				if (!big || index.sections[i].size > big->size)
+					big = &index.sections[i];
+			}
+
+			ldasm_sigset_compile(&sigs, big ? image + big->offset : NULL, big ? (size_t)big->size : 0);
+			for (size_t i = 0; i < index.section_count; i++) {
+				const ldasm_elf_section* sec = &index.sections[i];
+				found += scan_sigs(&sigs, image + sec->offset, (size_t)sec->size, sec->addr, is64);
+			}
+		}
+		else {
+			ldasm_sigset_compile(&sigs, image, size);
+			found = scan_sigs(&sigs, image, size, 0, is64);
+		} //if
+		t = now_sec() - t;
+
+		printf("signatures:      %zu, %zu matches in %.3f s\n", sigs.count, found, t);
+		ldasm_sigset_free(&sigs);
+	} //if
+
+	if (elf) {
+		size_t bad = 0;
+		for (size_t i = 0; i < index.count; i++)
+			bad += index.funcs[i].invalid != index.funcs[i].size;
+
+		printf("functions:       %zu (%zu with invalid code)\n", index.count, bad);
+
+		for (size_t i = 0; funcs && i < index.count; i++) {
+			const ldasm_func* f = &index.funcs[i];
+			printf("%016llx %8u %8u\n", (unsigned long long)f->start, f->size, f->invalid);
+		}
+
+		ldasm_elf_index_close(&index);
+	} //if
+
+	free(lengths);
+	free(out);
+	munmap(image, size);
+	return 0;
+}
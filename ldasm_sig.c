@@ -0,0 +1,425 @@
+#include "ldasm_sig.h"
+#include "ldasm_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Instruction-aligned signature scanner.
+//
+// Every signature is anchored on its rarest fixed byte pair (or single byte if no two fixed bytes
+// are adjacent), rated by byte frequencies sampled from the code. One pass over the region finds
+// anchor positions for all signatures at once:
+// - a SIMD prefilter in the style of Teddy: the signatures are spread over 7 buckets for pairs
+//   and 1 for single bytes, and four pshufb lookups on the nibbles of two consecutive bytes give
+//   the buckets that may start there
+// - an 8 KB bitmap of the anchor pairs in use, exact and L1 resident, when the signatures are too
+//   many for the nibble buckets to filter well
+// Candidates are checked against the signatures sharing their anchor, and only full byte matches
+// are decoded up to, to see if they start on an instruction boundary. Decoding starts a few
+// hundred bytes before an isolated match, x86 code resynchronizes within a few instructions, and
+// carries on from the last match when that is closer, so dense matches cost one linear sweep.
+
+#define END          UINT32_MAX
+#define PAIR_BUCKETS 7
+#define BYTE_BUCKET  0x80
+#define RESYNC_BYTES 256
+#define SAMPLE_MAX   (1u << 20)
+#define SAMPLE_BLOCK 4096
+
+/* prefilter candidates per byte above which the exact bitmap loop is faster */
+#define SIMD_MAX_RATE (1.0 / 16)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LDASM_SIMD 1
+#define LDASM_TARGET(x) __attribute__((target(x)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define LDASM_SIMD 1
+#define LDASM_TARGET(x)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+typedef struct _scan_state
+{
+	const ldasm_sigset* set;
+	const uint8_t*      p;
+	size_t              len;
+	const ldasm_tables* tables;
+	bool                is64;
+	ldasm_sig_match*    out;
+	size_t              cap;
+	size_t              found;
+	size_t              sync;   /* boundary the last check decoded up to */
+} scan_state;
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+int ldasm_sigset_add(ldasm_sigset* set, const char* pattern)
+{
+	ldasm_sig sig;
+	size_t fixed = 0;
+
+	if (!set || !pattern || set->count >= END)
+		return -1;
+
+	memset(&sig, 0, sizeof(sig));
+
+	for (const char* c = pattern; *c;) {
+		if (*c == ' ') {
+			++c;
+			continue;
+		} //if
+
+		if (sig.size == LDASM_SIG_MAX)
+			return -1;
+
+		if (*c == '?') {
+			c += c[1] == '?' ? 2 : 1;
+			++sig.size;
+			continue;
+		} //if
+
+		int hi = hex_digit(c[0]), lo = hi >= 0 ? hex_digit(c[1]) : -1;
+		if (lo < 0)
+			return -1;
+
+		sig.bytes[sig.size] = (uint8_t)(hi << 4 | lo);
+		sig.mask[sig.size++] = 0xFF;
+		++fixed;
+		c += 2;
+	}
+
+	if (!fixed)
+		return -1;
+
+	if (set->count == set->cap) {
+		size_t cap = set->cap ? set->cap * 2 : 64;
+		ldasm_sig* sigs = realloc(set->sigs, cap * sizeof(ldasm_sig));
+		if (!sigs)
+			return -1;
+		set->sigs = sigs;
+		set->cap = cap;
+	} //if
+
+	set->sigs[set->count] = sig;
+	set->compiled = false;
+	return (int)set->count++;
+}
+
+/* relative byte frequencies of typical x86-64 code, used without a sample */
+static void default_frequencies(double* freq)
+{
+	static const uint8_t common[] = { 0x48, 0x8B, 0x89, 0x0F, 0xE8, 0x24, 0x83, 0x85, 0xC0, 0x4C, 0x8D, 0x74,
+		0x44, 0x45, 0x41, 0x49, 0x84, 0x31, 0xC7, 0x75, 0x01, 0x08, 0x10 };
+
+	for (int i = 0; i < 256; i++)
+		freq[i] = 1.0;
+	for (size_t i = 0; i < sizeof(common); i++)
+		freq[common[i]] = 4.0;
+	freq[0x00] = freq[0xFF] = freq[0xCC] = 8.0;
+}
+
+/* sample up to SAMPLE_MAX bytes in blocks spread over the code */
+static void sample_frequencies(double* freq, const uint8_t* p, size_t len)
+{
+	uint64_t counts[256] = { 0 };
+	size_t stride = len > SAMPLE_MAX ? len / (SAMPLE_MAX / SAMPLE_BLOCK) : SAMPLE_BLOCK;
+
+	for (size_t at = 0; at < len; at += stride) {
+		size_t end = at + SAMPLE_BLOCK < len ? at + SAMPLE_BLOCK : len;
+		for (size_t i = at; i < end; i++)
+			++counts[p[i]];
+	}
+
+	/* +1 so a byte absent from the sample is rare, not impossible */
+	for (int i = 0; i < 256; i++)
+		freq[i] = (double)counts[i] + 1.0;
+}
+
+bool ldasm_sigset_compile(ldasm_sigset* set, const void* sample, size_t sample_len)
+{
+	double freq[256], total = 0;
+
+	if (!set)
+		return false;
+
+	if (sample && sample_len)
+		sample_frequencies(freq, (const uint8_t*)sample, sample_len);
+	else
+		default_frequencies(freq);
+
+	for (int i = 0; i < 256; i++)
+		total += freq[i];
+	for (int i = 0; i < 256; i++)
+		freq[i] /= total;
+
+	if (!set->pair_head) {
+		set->pair_head = malloc(65536 * sizeof(uint32_t));
+		if (!set->pair_head)
+			return false;
+	} //if
+
+	for (size_t i = 0; i < 65536; i++)
+		set->pair_head[i] = END;
+	for (size_t i = 0; i < 256; i++)
+		set->byte_head[i] = END;
+	memset(set->pair_bits, 0, sizeof(set->pair_bits));
+	memset(set->byte_bits, 0, sizeof(set->byte_bits));
+	memset(set->nibbles, 0, sizeof(set->nibbles));
+
+	/* the signatures are chained in reverse so each chain lists them in the order they were added */
+	for (size_t k = set->count; k-- > 0;) {
+		ldasm_sig* sig = &set->sigs[k];
+		double best = 2.0;
+
+		sig->anchor = 0;
+		sig->pair = false;
+
+		for (size_t i = 0; i < sig->size; i++) {
+			if (!sig->mask[i])
+				continue;
+
+			bool pair = i + 1 < sig->size && sig->mask[i + 1];
+			double rate = pair ? freq[sig->bytes[i]] * freq[sig->bytes[i + 1]] : freq[sig->bytes[i]];
+
+			/* a pair always beats a single byte, both prefilter bytes then do work */
+			if ((pair && !sig->pair) || (pair == sig->pair && rate < best)) {
+				sig->anchor = (uint8_t)i;
+				sig->pair = pair;
+				best = rate;
+			} //if
+		}
+
+		uint8_t b0 = sig->bytes[sig->anchor];
+
+		if (sig->pair) {
+			uint8_t b1 = sig->bytes[sig->anchor + 1];
+			uint32_t key = b0 | (uint32_t)b1 << 8;
+			uint8_t bucket = (uint8_t)(1u << (((key * 2654435761u) >> 16) % PAIR_BUCKETS));
+
+			sig->next = set->pair_head[key];
+			set->pair_head[key] = (uint32_t)k;
+			set->pair_bits[key >> 6] |= 1ull << (key & 63);
+
+			set->nibbles[0][b0 & 15] |= bucket;
+			set->nibbles[1][b0 >> 4] |= bucket;
+			set->nibbles[2][b1 & 15] |= bucket;
+			set->nibbles[3][b1 >> 4] |= bucket;
+		}
+		else {
+			sig->next = set->byte_head[b0];
+			set->byte_head[b0] = (uint32_t)k;
+			set->byte_bits[b0 >> 6] |= 1ull << (b0 & 63);
+
+			set->nibbles[0][b0 & 15] |= BYTE_BUCKET;
+			set->nibbles[1][b0 >> 4] |= BYTE_BUCKET;
+		} //if
+	}
+
+	/* single byte anchors accept any second byte */
+	for (int i = 0; i < 16; i++) {
+		set->nibbles[2][i] |= BYTE_BUCKET;
+		set->nibbles[3][i] |= BYTE_BUCKET;
+	}
+
+	/* share of positions the nibble buckets would let through */
+	double rate = 0;
+	for (int x = 0; x < 256; x++) {
+		uint8_t m0 = set->nibbles[0][x & 15] & set->nibbles[1][x >> 4];
+		if (!m0)
+			continue;
+		for (int y = 0; y < 256; y++) {
+			if (m0 & set->nibbles[2][y & 15] & set->nibbles[3][y >> 4])
+				rate += freq[x] * freq[y];
+		}
+	}
+
+	set->simd = rate < SIMD_MAX_RATE && ldasm_simd_level() != LDASM_SIMD_NONE;
+	set->compiled = true;
+	return true;
+}
+
+/* decode from a little before at, or on from the last check if it was closer, and see if the stream lands on it */
+static bool on_boundary(scan_state* st, size_t at)
+{
+	size_t pos = at > RESYNC_BYTES ? at - RESYNC_BYTES : 0;
+	ldasm_insn ld;
+
+	if (st->sync <= at && st->sync >= pos)
+		pos = st->sync;
+
+	while (pos < at) {
+		size_t n = ldasm_ex(st->p + pos, st->len - pos, st->tables, &ld, st->is64);
+		if (n == LDASM_TRUNCATED)
+			return false;
+		pos += n;
+	}
+
+	st->sync = pos;
+	return pos == at;
+}
+
+static void check_chain(scan_state* st, uint32_t s, size_t i)
+{
+	for (; s != END; s = st->set->sigs[s].next) {
+		const ldasm_sig* sig = &st->set->sigs[s];
+
+		if (i < sig->anchor || i - sig->anchor + sig->size > st->len)
+			continue;
+
+		const uint8_t* q = st->p + i - sig->anchor;
+		size_t k = 0;
+		while (k < sig->size && (q[k] & sig->mask[k]) == sig->bytes[k])
+			++k;
+
+		if (k < sig->size || !on_boundary(st, i - sig->anchor))
+			continue;
+
+		if (st->found < st->cap)
+			st->out[st->found] = (ldasm_sig_match){ .sig = s, .offset = i - sig->anchor };
+		++st->found;
+	}
+}
+
+/* exact test of position i against both anchor kinds */
+static inline void check_position(scan_state* st, size_t i)
+{
+	const ldasm_sigset* set = st->set;
+	uint8_t b0 = st->p[i];
+
+	if ((set->byte_bits[b0 >> 6] >> (b0 & 63)) & 1)
+		check_chain(st, set->byte_head[b0], i);
+
+	if (i + 1 < st->len) {
+		uint32_t key = b0 | (uint32_t)st->p[i + 1] << 8;
+		if ((set->pair_bits[key >> 6] >> (key & 63)) & 1)
+			check_chain(st, set->pair_head[key], i);
+	} //if
+}
+
+static void scan_scalar(scan_state* st, size_t from)
+{
+	const ldasm_sigset* set = st->set;
+	const uint8_t* p = st->p;
+	size_t i = from;
+
+	/* the pair bitmap alone in the hot loop, single byte anchors are rare */
+	bool any_byte = set->byte_bits[0] | set->byte_bits[1] | set->byte_bits[2] | set->byte_bits[3];
+
+	for (; i + 1 < st->len; i++) {
+		uint32_t key = p[i] | (uint32_t)p[i + 1] << 8;
+		if (((set->pair_bits[key >> 6] >> (key & 63)) & 1) || any_byte)
+			check_position(st, i);
+	}
+
+	if (i < st->len)
+		check_position(st, i);
+}
+
+#ifdef LDASM_SIMD
+
+LDASM_TARGET("ssse3")
+static size_t scan_ssse3(scan_state* st)
+{
+	const __m128i nib = _mm_set1_epi8(0x0F);
+	const __m128i t0 = _mm_loadu_si128((const __m128i*)st->set->nibbles[0]);
+	const __m128i t1 = _mm_loadu_si128((const __m128i*)st->set->nibbles[1]);
+	const __m128i t2 = _mm_loadu_si128((const __m128i*)st->set->nibbles[2]);
+	const __m128i t3 = _mm_loadu_si128((const __m128i*)st->set->nibbles[3]);
+	size_t i = 0;
+
+	for (; i + 17 <= st->len; i += 16) {
+		__m128i v0 = _mm_loadu_si128((const __m128i*)(st->p + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(st->p + i + 1));
+
+		__m128i m = _mm_and_si128(
+			_mm_and_si128(_mm_shuffle_epi8(t0, _mm_and_si128(v0, nib)), _mm_shuffle_epi8(t1, _mm_and_si128(_mm_srli_epi16(v0, 4), nib))),
+			_mm_and_si128(_mm_shuffle_epi8(t2, _mm_and_si128(v1, nib)), _mm_shuffle_epi8(t3, _mm_and_si128(_mm_srli_epi16(v1, 4), nib))));
+
+		uint32_t hits = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) & 0xFFFF;
+		while (hits) {
+			check_position(st, i + ldasm_ctz64(hits));
+			hits &= hits - 1;
+		}
+	}
+
+	return i;
+}
+
+LDASM_TARGET("avx2")
+static size_t scan_avx2(scan_state* st)
+{
+	const __m256i nib = _mm256_set1_epi8(0x0F);
+	const __m256i t0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)st->set->nibbles[0]));
+	const __m256i t1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)st->set->nibbles[1]));
+	const __m256i t2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)st->set->nibbles[2]));
+	const __m256i t3 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)st->set->nibbles[3]));
+	size_t i = 0;
+
+	for (; i + 33 <= st->len; i += 32) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i*)(st->p + i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i*)(st->p + i + 1));
+
+		__m256i m = _mm256_and_si256(
+			_mm256_and_si256(_mm256_shuffle_epi8(t0, _mm256_and_si256(v0, nib)),
+				_mm256_shuffle_epi8(t1, _mm256_and_si256(_mm256_srli_epi16(v0, 4), nib))),
+			_mm256_and_si256(_mm256_shuffle_epi8(t2, _mm256_and_si256(v1, nib)),
+				_mm256_shuffle_epi8(t3, _mm256_and_si256(_mm256_srli_epi16(v1, 4), nib))));
+
+		uint32_t hits = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+		while (hits) {
+			check_position(st, i + ldasm_ctz64(hits));
+			hits &= hits - 1;
+		}
+	}
+
+	return i;
+}
+
+#endif // LDASM_SIMD
+
+size_t ldasm_sigset_scan(const ldasm_sigset* set, const void* code, size_t len, const ldasm_tables* tables,
+	bool is64, ldasm_sig_match* out, size_t cap)
+{
+	scan_state st = { .set = set, .p = (const uint8_t*)code, .len = len, .is64 = is64, .out = out, .cap = out ? cap : 0,
+		.sync = SIZE_MAX };
+	size_t from = 0;
+
+	if (!set || !set->compiled || !code || !set->count)
+		return 0;
+
+	st.tables = tables ? tables : ldasm_default_tables();
+
+#ifdef LDASM_SIMD
+	if (set->simd) {
+		if (ldasm_simd_level() == LDASM_SIMD_AVX2)
+			from = scan_avx2(&st);
+		else
+			from = scan_ssse3(&st);
+	} //if
+#endif
+
+	/* tail of the region, or every position when the prefilter would not pay off */
+	scan_scalar(&st, from);
+	return st.found;
+}
+
+void ldasm_sigset_free(ldasm_sigset* set)
+{
+	if (!set)
+		return;
+
+	free(set->sigs);
+	free(set->pair_head);
+	memset(set, 0, sizeof(*set));
+}
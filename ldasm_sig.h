@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ldasm.h"
+
+#define LDASM_SIG_MAX 64
+
+typedef struct _ldasm_sig
+{
+	uint8_t  bytes[LDASM_SIG_MAX];  /* wildcard bytes are 0 */
+	uint8_t  mask[LDASM_SIG_MAX];   /* 0xFF fixed, 0 wildcard */
+	uint8_t  size;
+	uint8_t  anchor;                /* offset of the fixed byte(s) the prefilter looks for */
+	bool     pair;                  /* anchor is two adjacent fixed bytes, else one */
+	uint32_t next;                  /* next signature with the same anchor */
+} ldasm_sig;
+
+typedef struct _ldasm_sigset
+{
+	ldasm_sig* sigs;
+	size_t     count;
+	size_t     cap;
+
+	/* built by ldasm_sigset_compile() */
+	uint32_t*  pair_head;           /* first signature per anchor pair (first byte low), 65536 entries */
+	uint32_t   byte_head[256];      /* first signature per single anchor byte */
+	uint64_t   pair_bits[1024];     /* anchor pairs in use */
+	uint64_t   byte_bits[4];        /* single anchor bytes in use */
+	uint8_t    nibbles[4][16];      /* SIMD prefilter buckets: low and high nibble of both anchor bytes */
+	bool       simd;                /* the SIMD prefilter is selective enough to use */
+	bool       compiled;
+} ldasm_sigset;
+
+typedef struct _ldasm_sig_match
+{
+	uint32_t sig;                   /* index returned by ldasm_sigset_add() */
+	size_t   offset;                /* from the start of the scanned region */
+} ldasm_sig_match;
+
+/**
+ * @brief Add a signature like "48 8B 05 ?? ?? ?? ?? 48 85 C0", zero-initialize set before the first call
+ *
+ * @return Index of the signature, or -1 if the pattern has no fixed byte, is longer than
+ *         LDASM_SIG_MAX or cannot be parsed
+ */
+int ldasm_sigset_add(ldasm_sigset* set, const char* pattern);
+
+/**
+ * @brief Pick the anchors of every signature and build the prefilter, call after the last add
+ *
+ * Anchors are the rarest fixed bytes according to a sample of the code to scan (NULL = typical
+ * x86 byte frequencies).
+ */
+bool ldasm_sigset_compile(ldasm_sigset* set, const void* sample, size_t sample_len);
+
+/**
+ * @brief Find all signatures in a code region in one pass
+ *
+ * Only matches starting on an instruction boundary count. Boundaries are decoded from 256 bytes
+ * before each byte-level match, or from the previous match when it is closer, x86 code
+ * resynchronizes within a few instructions.
+ * Up to cap matches are stored into out in scan order.
+ *
+ * @return Number of matches, which may exceed cap
+ */
+size_t ldasm_sigset_scan(const ldasm_sigset* set, const void* code, size_t len, const ldasm_tables* tables,
+	bool is64, ldasm_sig_match* out, size_t cap);
+
+/**
+ * @brief Release the signatures and the prefilter
+ */
+void ldasm_sigset_free(ldasm_sigset* set);
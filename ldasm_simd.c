@@ -0,0 +1,490 @@
+#include "ldasm_internal.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <stdatomic.h>
+#endif
+
+// Vectorized instruction-length sweep.
+//
+// For every byte of a 16/32 byte window the kernel computes the length of the instruction that
+// would start there, assuming a plain one-byte opcode with an optional REX prefix. The opcode
+// table is looked up once per window with pshufb over the low nibble, one row per high nibble, and
+// shifted by a byte for the opcode behind a REX; the ModR/M info only depends on mod and on rm
+// being 4 or 5, which takes three nibble lookups. The lengths are then chained sequentially, and
+// positions the kernel cannot size (prefixes, 0F escapes, VEX/EVEX/XOP, F6/F7, SIB with base 5,
+// ...) are handed to the scalar decoder. When that happens for more than a quarter of a window,
+// the following instructions go to the scalar sweep, for a run that doubles while the windows
+// keep missing, so code the kernel cannot size is swept as fast as without it.
+//
+// The CPU is probed once, and the kernel tables are built once for the default tables (both
+// modes). Caller tables keep their kernel tables in a one-entry cache per thread, checked against
+// the tables' contents, so sweeping in batches does not rebuild them on every call.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LDASM_SIMD 1
+#define LDASM_TARGET(x) __attribute__((target(x)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define LDASM_SIMD 1
+#define LDASM_TARGET(x)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+/* opcode info: low nibble is the length without ModR/M (0 = use scalar decoder) */
+#define SI_LEN   0x0F
+#define SI_MODRM 0x10
+#define SI_REX   0x20
+#define SI_WIDE  0x40   /* immediate becomes 8 bytes with REX.W */
+
+/* ModR/M info: low nibble is the length of ModR/M + SIB + displacement */
+#define MI_LEN   0x0F
+#define MI_SIB5  0x10   /* SIB with mod == 0, base 5 adds disp32 */
+
+/* instructions swept scalar after a window where more than 1 in BAIL_RATIO missed, doubling */
+#define BAIL_RATIO   4
+#define BAIL_MIN     16
+#define BAIL_MAX     1024
+
+typedef struct _simd_tables
+{
+	LDASM_ALIGN(32) uint8_t op[256];
+} simd_tables;
+
+/* the ModR/M info only depends on mod and on rm being 4 or 5, three nibble lookups find it */
+static LDASM_ALIGN(16) const uint8_t mrm_rm_class[16] = {
+	0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 1, 2, 0, 0
+};
+
+static LDASM_ALIGN(16) const uint8_t mrm_mod4[16] = {
+	0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12
+};
+
+/* indexed by mod * 4 + rm class */
+static LDASM_ALIGN(16) const uint8_t mrm_info[16] = {
+	1, 2 | MI_SIB5, 5, 0,
+	2, 3,           2, 0,
+	5, 6,           5, 0,
+	1, 1,           1, 0,
+};
+
+static void build_simd_tables(simd_tables* st, const ldasm_tables* tables, bool is64)
+{
+	for (int i = 0; i < 256; i++) {
+		uint8_t f = tables->flags[i];
+		uint8_t info = 0;
+
+		if (is64 && (i >> 4) == 4) {
+			info = SI_REX;
+		}
+		else if (!(f & OP_PREFIX) && i != 0x0F && i != 0xF6 && i != 0xF7 && (i < 0xA0 || i > 0xA3) &&
+			i != 0xC4 && i != 0xC5 && i != 0x62 && i != 0x8F) {
+			uint8_t imm = (f & (OP_DATA_I16_I32 | OP_DATA_I16_I32_I64)) ? 4u : 0u;
+			imm += f & 3u;
+			info = (uint8_t)(1u + imm);
+			if (f & OP_MODRM)
+				info |= SI_MODRM;
+			if (is64 && i >= 0xB8 && i <= 0xBF && (f & OP_DATA_I16_I32_I64))
+				info |= SI_WIDE;
+		} //if
+
+		st->op[i] = info;
+	}
+}
+
+/* chain the window lengths, falling back to the scalar decoder where the kernel gave up */
+static inline bool walk_window(const uint8_t* p, size_t len, const uint8_t* win, size_t width,
+	const ldasm_tables* tables, bool is64, uint8_t* lengths, size_t cap, size_t* pos, size_t* count, size_t* misses)
+{
+	size_t start = *pos;
+	ldasm_insn ld;
+
+	while (*pos - start < width && *count < cap) {
+		size_t n = win[*pos - start];
+
+		if (!n) {
+			n = ldasm_ex(p + *pos, len - *pos, tables, &ld, is64);
+			if (n == LDASM_TRUNCATED)
+				return false;
+			++*misses;
+		}
+		else if (n > len - *pos) {
+			return false;
+		} //if
+
+		if (lengths)
+			lengths[*count] = (uint8_t)n;
+
+		*pos += n;
+		++*count;
+	}
+
+	return true;
+}
+
+/* sweep up to run instructions ending before end with the scalar decoder */
+static inline void sweep_scalar(const uint8_t* p, size_t end, const ldasm_tables* tables, bool is64,
+	uint8_t* lengths, size_t cap, size_t* pos, size_t* count, size_t run)
+{
+	size_t used;
+	size_t n = ldasm_sweep(p + *pos, end - *pos, tables, is64, NULL, lengths ? lengths + *count : NULL,
+		run < cap - *count ? run : cap - *count, &used);
+
+	*pos += used;
+	*count += n;
+}
+
+/* instructions to leave to the scalar decoder after a window, growing while windows keep missing */
+static inline size_t next_bail(size_t bail, size_t insns, size_t misses)
+{
+	if (misses * BAIL_RATIO <= insns)
+		return 0;
+	return bail ? (bail * 2 < BAIL_MAX ? bail * 2 : BAIL_MAX) : BAIL_MIN;
+}
+
+#ifdef LDASM_SIMD
+
+LDASM_TARGET("ssse3")
+static inline __m128i lut256_128(__m128i v, const uint8_t* table)
+{
+	const __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+	const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+	__m128i r = _mm_setzero_si128();
+
+	for (int h = 0; h < 16; h++) {
+		__m128i row = _mm_load_si128((const __m128i*)(table + h * 16));
+		__m128i sel = _mm_cmpeq_epi8(hi, _mm_set1_epi8((char)h));
+		r = _mm_or_si128(r, _mm_and_si128(sel, _mm_shuffle_epi8(row, lo)));
+	}
+
+	return r;
+}
+
+LDASM_TARGET("ssse3")
+static inline __m128i mrm_128(__m128i v)
+{
+	const __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+	const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+
+	__m128i idx = _mm_or_si128(_mm_shuffle_epi8(_mm_load_si128((const __m128i*)mrm_rm_class), lo),
+		_mm_shuffle_epi8(_mm_load_si128((const __m128i*)mrm_mod4), hi));
+	return _mm_shuffle_epi8(_mm_load_si128((const __m128i*)mrm_info), idx);
+}
+
+LDASM_TARGET("ssse3")
+static inline __m128i len_norex_128(__m128i op, __m128i m1, __m128i v2)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i nib = _mm_set1_epi8(0x0F);
+
+	__m128i base = _mm_and_si128(op, nib);
+	__m128i has_mrm = _mm_cmpeq_epi8(_mm_and_si128(op, _mm_set1_epi8(SI_MODRM)), _mm_set1_epi8(SI_MODRM));
+	__m128i sib5 = _mm_cmpeq_epi8(_mm_and_si128(m1, _mm_set1_epi8(MI_SIB5)), _mm_set1_epi8(MI_SIB5));
+	__m128i base5 = _mm_cmpeq_epi8(_mm_and_si128(v2, _mm_set1_epi8(7)), _mm_set1_epi8(5));
+	__m128i mext = _mm_add_epi8(_mm_and_si128(m1, nib), _mm_and_si128(_mm_and_si128(sib5, base5), _mm_set1_epi8(4)));
+	__m128i l = _mm_add_epi8(base, _mm_and_si128(has_mrm, mext));
+
+	return _mm_andnot_si128(_mm_cmpeq_epi8(base, zero), l);
+}
+
+LDASM_TARGET("ssse3")
+static size_t sweep_ssse3(const uint8_t* p, size_t len, const simd_tables* st, const ldasm_tables* tables,
+	bool is64, uint8_t* lengths, size_t cap, size_t* pos, size_t count)
+{
+	LDASM_ALIGN(32) uint8_t win[16];
+	size_t bail = 0;
+
+	while (*pos + 16 + 3 <= len && count < cap) {
+		/* the last windows missed too often, the scalar decoder is faster here */
+		if (bail) {
+			sweep_scalar(p, len - (16 + 3), tables, is64, lengths, cap, pos, &count, bail);
+			if (count == cap)
+				break;
+		} //if
+
+		const uint8_t* q = p + *pos;
+		__m128i v0 = _mm_loadu_si128((const __m128i*)q);
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(q + 1));
+		__m128i v2 = _mm_loadu_si128((const __m128i*)(q + 2));
+		__m128i v3 = _mm_loadu_si128((const __m128i*)(q + 3));
+
+		/* the opcode info at q + 1 is the one at q shifted by a byte */
+		__m128i op0 = lut256_128(v0, st->op);
+		__m128i op1 = _mm_alignr_epi8(_mm_cvtsi32_si128(st->op[q[16]]), op0, 1);
+		__m128i l0 = len_norex_128(op0, mrm_128(v1), v2);
+		__m128i l1 = len_norex_128(op1, mrm_128(v2), v3);
+
+		/* REX prefix: one byte plus the instruction behind it, REX.W mov r64, imm64 takes 4 more */
+		__m128i rex = _mm_cmpeq_epi8(_mm_and_si128(op0, _mm_set1_epi8(SI_REX)), _mm_set1_epi8(SI_REX));
+		__m128i wide = _mm_and_si128(
+			_mm_cmpeq_epi8(_mm_and_si128(op1, _mm_set1_epi8(SI_WIDE)), _mm_set1_epi8(SI_WIDE)),
+			_mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(8)), _mm_set1_epi8(8)));
+		__m128i lr = _mm_add_epi8(_mm_add_epi8(l1, _mm_set1_epi8(1)), _mm_and_si128(wide, _mm_set1_epi8(4)));
+		lr = _mm_andnot_si128(_mm_cmpeq_epi8(l1, _mm_setzero_si128()), lr);
+		__m128i l = _mm_or_si128(_mm_and_si128(rex, lr), _mm_andnot_si128(rex, l0));
+
+		_mm_store_si128((__m128i*)win, l);
+
+		size_t first = count, misses = 0;
+		if (!walk_window(p, len, win, 16, tables, is64, lengths, cap, pos, &count, &misses))
+			break;
+		bail = next_bail(bail, count - first, misses);
+	}
+
+	return count;
+}
+
+LDASM_TARGET("avx2")
+static inline __m256i lut256_256(__m256i v, const uint8_t* table)
+{
+	const __m256i lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0F));
+	const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+	__m256i r = _mm256_setzero_si256();
+
+	for (int h = 0; h < 16; h++) {
+		__m256i row = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)(table + h * 16)));
+		__m256i sel = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8((char)h));
+		r = _mm256_or_si256(r, _mm256_and_si256(sel, _mm256_shuffle_epi8(row, lo)));
+	}
+
+	return r;
+}
+
+LDASM_TARGET("avx2")
+static inline __m256i mrm_256(__m256i v)
+{
+	const __m256i lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0F));
+	const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+
+	__m256i idx = _mm256_or_si256(
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)mrm_rm_class)), lo),
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)mrm_mod4)), hi));
+	return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)mrm_info)), idx);
+}
+
+LDASM_TARGET("avx2")
+static inline __m256i len_norex_256(__m256i op, __m256i m1, __m256i v2)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i nib = _mm256_set1_epi8(0x0F);
+
+	__m256i base = _mm256_and_si256(op, nib);
+	__m256i has_mrm = _mm256_cmpeq_epi8(_mm256_and_si256(op, _mm256_set1_epi8(SI_MODRM)), _mm256_set1_epi8(SI_MODRM));
+	__m256i sib5 = _mm256_cmpeq_epi8(_mm256_and_si256(m1, _mm256_set1_epi8(MI_SIB5)), _mm256_set1_epi8(MI_SIB5));
+	__m256i base5 = _mm256_cmpeq_epi8(_mm256_and_si256(v2, _mm256_set1_epi8(7)), _mm256_set1_epi8(5));
+	__m256i mext = _mm256_add_epi8(_mm256_and_si256(m1, nib), _mm256_and_si256(_mm256_and_si256(sib5, base5), _mm256_set1_epi8(4)));
+	__m256i l = _mm256_add_epi8(base, _mm256_and_si256(has_mrm, mext));
+
+	return _mm256_andnot_si256(_mm256_cmpeq_epi8(base, zero), l);
+}
+
+LDASM_TARGET("avx2")
+static size_t sweep_avx2(const uint8_t* p, size_t len, const simd_tables* st, const ldasm_tables* tables,
+	bool is64, uint8_t* lengths, size_t cap, size_t* pos, size_t count)
+{
+	LDASM_ALIGN(32) uint8_t win[32];
+	size_t bail = 0;
+
+	while (*pos + 32 + 3 <= len && count < cap) {
+		/* the last windows missed too often, the scalar decoder is faster here */
+		if (bail) {
+			sweep_scalar(p, len - (32 + 3), tables, is64, lengths, cap, pos, &count, bail);
+			if (count == cap)
+				break;
+		} //if
+
+		const uint8_t* q = p + *pos;
+		__m256i v0 = _mm256_loadu_si256((const __m256i*)q);
+		__m256i v1 = _mm256_loadu_si256((const __m256i*)(q + 1));
+		__m256i v2 = _mm256_loadu_si256((const __m256i*)(q + 2));
+		__m256i v3 = _mm256_loadu_si256((const __m256i*)(q + 3));
+
+		/* the opcode info at q + 1 is the one at q shifted by a byte, across the lanes */
+		__m256i op0 = lut256_256(v0, st->op);
+		__m256i next = _mm256_permute2x128_si256(op0, _mm256_castsi128_si256(_mm_cvtsi32_si128(st->op[q[32]])), 0x21);
+		__m256i op1 = _mm256_alignr_epi8(next, op0, 1);
+		__m256i l0 = len_norex_256(op0, mrm_256(v1), v2);
+		__m256i l1 = len_norex_256(op1, mrm_256(v2), v3);
+
+		/* REX prefix: one byte plus the instruction behind it, REX.W mov r64, imm64 takes 4 more */
+		__m256i rex = _mm256_cmpeq_epi8(_mm256_and_si256(op0, _mm256_set1_epi8(SI_REX)), _mm256_set1_epi8(SI_REX));
+		__m256i wide = _mm256_and_si256(
+			_mm256_cmpeq_epi8(_mm256_and_si256(op1, _mm256_set1_epi8(SI_WIDE)), _mm256_set1_epi8(SI_WIDE)),
+			_mm256_cmpeq_epi8(_mm256_and_si256(v0, _mm256_set1_epi8(8)), _mm256_set1_epi8(8)));
+		__m256i lr = _mm256_add_epi8(_mm256_add_epi8(l1, _mm256_set1_epi8(1)), _mm256_and_si256(wide, _mm256_set1_epi8(4)));
+		lr = _mm256_andnot_si256(_mm256_cmpeq_epi8(l1, _mm256_setzero_si256()), lr);
+		__m256i l = _mm256_blendv_epi8(l0, lr, rex);
+
+		_mm256_store_si256((__m256i*)win, l);
+
+		size_t first = count, misses = 0;
+		if (!walk_window(p, len, win, 32, tables, is64, lengths, cap, pos, &count, &misses))
+			break;
+		bail = next_bail(bail, count - first, misses);
+	}
+
+	return count;
+}
+
+static enum ldasm_simd_level detect_simd(void)
+{
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuid(r, 0);
+	int max_leaf = r[0];
+
+	__cpuid(r, 1);
+	bool ssse3 = (r[2] >> 9) & 1;
+	bool osavx = ((r[2] >> 27) & 1) && ((r[2] >> 28) & 1) && (_xgetbv(0) & 6) == 6;
+
+	/* AVX2 is reported in leaf 7, SSSE3 does not need it */
+	if (max_leaf >= 7 && osavx) {
+		__cpuidex(r, 7, 0);
+		if ((r[1] >> 5) & 1)
+			return LDASM_SIMD_AVX2;
+	} //if
+
+	return ssse3 ? LDASM_SIMD_SSSE3 : LDASM_SIMD_NONE;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return LDASM_SIMD_AVX2;
+	if (__builtin_cpu_supports("ssse3"))
+		return LDASM_SIMD_SSSE3;
+	return LDASM_SIMD_NONE;
+#endif
+}
+
+/* level and kernel tables of the default tables, built once on first use */
+static enum ldasm_simd_level simd_level;
+static simd_tables default_simd[2];
+static const ldasm_tables* default_simd_source;
+
+static void init_simd(void)
+{
+	simd_level = detect_simd();
+	default_simd_source = ldasm_default_tables();
+
+	if (default_simd_source) {
+		build_simd_tables(&default_simd[0], default_simd_source, false);
+		build_simd_tables(&default_simd[1], default_simd_source, true);
+	} //if
+}
+
+#if defined(_WIN32)
+static INIT_ONCE simd_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK init_simd_once(PINIT_ONCE once, PVOID param, PVOID* ctx)
+{
+	(void)once; (void)param; (void)ctx;
+	init_simd();
+	return TRUE;
+}
+
+static void simd_ready(void)
+{
+	InitOnceExecuteOnce(&simd_once, init_simd_once, NULL, NULL);
+}
+#else
+/* 0 - not initialized, 1 - initializing, 2 - ready */
+static atomic_int simd_state;
+
+static void simd_ready(void)
+{
+	int state = atomic_load_explicit(&simd_state, memory_order_acquire);
+
+	if (state != 2) {
+		int expected = 0;
+		if (atomic_compare_exchange_strong(&simd_state, &expected, 1)) {
+			init_simd();
+			atomic_store_explicit(&simd_state, 2, memory_order_release);
+		}
+		else {
+			while (atomic_load_explicit(&simd_state, memory_order_acquire) != 2)
+				;
+		} //if
+	} //if
+}
+#endif
+
+/* caller tables, the last ones this thread swept with */
+typedef struct _simd_cache
+{
+	const ldasm_tables* source;
+	bool                is64;
+	ldasm_tables        copy;
+	simd_tables         st;
+} simd_cache;
+
+static _Thread_local simd_cache thread_simd;
+
+static const simd_tables* simd_tables_of(const ldasm_tables* tables, bool is64)
+{
+	if (tables == default_simd_source)
+		return &default_simd[is64];
+
+	/* the caller may have refilled the same tables since */
+	simd_cache* c = &thread_simd;
+	if (c->source != tables || c->is64 != is64 || memcmp(&c->copy, tables, sizeof(*tables))) {
+		c->source = tables;
+		c->is64 = is64;
+		c->copy = *tables;
+		build_simd_tables(&c->st, tables, is64);
+	} //if
+
+	return &c->st;
+}
+
+#endif // LDASM_SIMD
+
+enum ldasm_simd_level ldasm_simd_level(void)
+{
+#ifdef LDASM_SIMD
+	simd_ready();
+	return simd_level;
+#else
+	return LDASM_SIMD_NONE;
+#endif
+}
+
+size_t ldasm_sweep_lengths(const void* code, size_t len, const ldasm_tables* tables, bool is64,
+	uint8_t* lengths, size_t cap, size_t* consumed)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	size_t pos = 0, count = 0, tail = 0;
+
+	if (!p) {
+		if (consumed)
+			*consumed = 0;
+		return 0;
+	} //if
+
+	if (!tables)
+		tables = ldasm_default_tables();
+
+#ifdef LDASM_SIMD
+	simd_ready();
+
+	if (simd_level != LDASM_SIMD_NONE && len >= 64) {
+		const simd_tables* st = simd_tables_of(tables, is64);
+
+		if (simd_level == LDASM_SIMD_AVX2)
+			count = sweep_avx2(p, len, st, tables, is64, lengths, cap, &pos, count);
+		else
+			count = sweep_ssse3(p, len, st, tables, is64, lengths, cap, &pos, count);
+	} //if
+#endif
+
+	/* tail of the buffer, or no SIMD support */
+	if (count < cap && pos < len)
+		count += ldasm_sweep(p + pos, len - pos, tables, is64, NULL, lengths ? lengths + count : NULL, cap - count, &tail);
+
+	if (consumed)
+		*consumed = pos + tail;
+
+	return count;
+}
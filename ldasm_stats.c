@@ -0,0 +1,107 @@
+#include "ldasm_stats.h"
+#include "ldasm_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Decoder counters.
+//
+// Built with -DLDASM_STATS the decoder counts each phase it goes through and the opcode bytes it
+// sees. Every thread counts into a block of its own, taken on its first decode and pushed onto a
+// global list so snapshots can sum all threads. Blocks outlive their threads so their counts stay
+// in the sum. Threads that get no block share one that is counted with atomic adds. Without
+// LDASM_STATS the counting macros are empty and only these stubs remain.
+
+#ifdef LDASM_STATS
+
+_Thread_local ldasm_stats_block* ldasm_thread_stats;
+
+static _Atomic(ldasm_stats_block*) blocks;
+
+/* shared by threads whose block could not be allocated, counted with atomic adds */
+static ldasm_stats_block overflow = { .shared = true };
+
+ldasm_stats_block* ldasm_stats_attach(void)
+{
+	ldasm_stats_block* block = calloc(1, sizeof(ldasm_stats_block));
+	if (!block)
+		return ldasm_thread_stats = &overflow;
+
+	block->next = atomic_load_explicit(&blocks, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&blocks, &block->next, block,
+		memory_order_release, memory_order_relaxed))
+		;
+
+	return ldasm_thread_stats = block;
+}
+
+static void add_block(ldasm_stats* stats, ldasm_stats_block* block)
+{
+	uint64_t* out = (uint64_t*)stats;
+
+	for (size_t i = 0; i < LDASM_STATS_COUNTERS; i++)
+		out[i] += atomic_load_explicit(&block->counters[i], memory_order_relaxed);
+}
+
+static void reset_block(ldasm_stats_block* block)
+{
+	for (size_t i = 0; i < LDASM_STATS_COUNTERS; i++)
+		atomic_store_explicit(&block->counters[i], 0, memory_order_relaxed);
+}
+
+bool ldasm_stats_enabled(void)
+{
+	return true;
+}
+
+void ldasm_stats_snapshot(ldasm_stats* stats, bool all_threads)
+{
+	if (!stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!all_threads) {
+		if (ldasm_thread_stats)
+			add_block(stats, ldasm_thread_stats);
+		return;
+	} //if
+
+	for (ldasm_stats_block* b = atomic_load_explicit(&blocks, memory_order_acquire); b; b = b->next)
+		add_block(stats, b);
+	add_block(stats, &overflow);
+}
+
+void ldasm_stats_reset(bool all_threads)
+{
+	if (!all_threads) {
+		if (ldasm_thread_stats)
+			reset_block(ldasm_thread_stats);
+		return;
+	} //if
+
+	for (ldasm_stats_block* b = atomic_load_explicit(&blocks, memory_order_acquire); b; b = b->next)
+		reset_block(b);
+	reset_block(&overflow);
+}
+
+#else
+
+bool ldasm_stats_enabled(void)
+{
+	return false;
+}
+
+void ldasm_stats_snapshot(ldasm_stats* stats, bool all_threads)
+{
+	(void)all_threads;
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
+}
+
+void ldasm_stats_reset(bool all_threads)
+{
+	(void)all_threads;
+}
+
+#endif // LDASM_STATS
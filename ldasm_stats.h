@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ldasm.h"
+
+typedef struct _ldasm_stats
+{
+	uint64_t decodes;
+	uint64_t bytes;             /* lengths of the decoded instructions */
+	uint64_t prefix_bytes;      /* prefix loop iterations */
+	uint64_t rex;
+	uint64_t two_byte;          /* 0F xx */
+	uint64_t three_byte;        /* 0F xx xx (OP_EXTENDED) */
+	uint64_t vex;               /* VEX, EVEX and XOP */
+	uint64_t modrm;
+	uint64_t sib;
+	uint64_t disp;
+	uint64_t imm;
+	uint64_t invalid;
+	uint64_t truncated;
+	uint64_t opcode[256];       /* first opcode byte */
+	uint64_t opcode_0f[256];    /* byte after 0F */
+	uint64_t opcode_vex[256];   /* opcode byte after a VEX, EVEX or XOP prefix */
+} ldasm_stats;
+
+/**
+ * @brief True if the library was built with LDASM_STATS, the other functions only return zeros otherwise
+ */
+bool ldasm_stats_enabled(void);
+
+/**
+ * @brief Copy the counters of the calling thread, or the sum over every thread that decoded
+ *
+ * Counters of other threads are read while they may still be counting, so the sum can lag.
+ */
+void ldasm_stats_snapshot(ldasm_stats* stats, bool all_threads);
+
+/**
+ * @brief Zero the counters of the calling thread, or of every thread
+ *
+ * Counts made by other threads while they are reset may survive.
+ */
+void ldasm_stats_reset(bool all_threads);
@@ -0,0 +1,662 @@
+#define _GNU_SOURCE
+
+#include "ldasm_verify.h"
+#include "ldasm_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Differential validation of the decoder paths.
+//
+// Enumerates prefix x opcode (one byte, 0F xx, three-byte maps, VEX/EVEX/XOP maps) x ModR/M x SIB
+// in 32- and 64-bit mode. Every encoding is checked in three ways:
+// - ldasm_ex() against ldasm(), with exactly the right number of bytes at the end of a guard
+//   page and with one byte less
+// - the batch paths (ldasm_sweep, ldasm_sweep_lengths, ldasm_sweep_parallel, ldasm_sweep_soa,
+//   ldasm_sweep_packed) against the reference records, over streams of enumerated instructions,
+//   with the full count and cut short at a few caps, among them the chunk borders of the parallel
+//   sweep
+// - optionally the lengths against objdump
+// Every mismatch is shrunk to a minimal byte string before it is reported.
+
+#define STREAM_SIZE   (256u << 10)
+#define MAX_INSN      32
+#define SWEEP_THREADS 4
+#define SHORT_CAPS    (SWEEP_THREADS + 2)
+#define OBJDUMP_SLOT  32
+
+typedef struct _verify_insn
+{
+	uint8_t    bytes[MAX_INSN];
+	uint8_t    size;
+	ldasm_insn ld;
+} verify_insn;
+
+typedef struct _verify_state
+{
+	bool         is64;
+	unsigned     max_reports;
+	size_t       checked;
+	size_t       mismatches;
+
+	/* guard page, bytes placed right before it fault when read past */
+	uint8_t*     guard;
+	size_t       page;
+
+	/* stream of enumerated instructions and their reference decode */
+	uint8_t*     stream;
+	size_t       stream_len;
+	verify_insn* insns;
+	size_t       count;
+	uint8_t*     lengths;
+	ldasm_insn*  out;
+	uint32_t*    packed;
+
+	/* objdump slots */
+	FILE*        slots;
+	verify_insn* slot_insns;
+	size_t       slot_count;
+	size_t       slot_cap;
+} verify_state;
+
+typedef bool (*mismatch_fn)(verify_state* vs, const uint8_t* bytes, size_t size);
+
+static void print_bytes(const uint8_t* bytes, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		printf("%02X ", bytes[i]);
+}
+
+/* remove bytes, then clear bytes, as long as the mismatch persists */
+static size_t shrink(verify_state* vs, uint8_t* bytes, size_t size, mismatch_fn fn)
+{
+	bool changed = true;
+
+	while (changed) {
+		changed = false;
+
+		for (size_t i = 0; i < size && size > 1; i++) {
+			uint8_t tmp[MAX_INSN];
+			memcpy(tmp, bytes, i);
+			memcpy(tmp + i, bytes + i + 1, size - i - 1);
+			if (fn(vs, tmp, size - 1)) {
+				memcpy(bytes, tmp, --size);
+				changed = true;
+				--i;
+			} //if
+		}
+
+		for (size_t i = 0; i < size; i++) {
+			if (!bytes[i])
+				continue;
+			uint8_t old = bytes[i];
+			bytes[i] = 0;
+			if (fn(vs, bytes, size))
+				changed = true;
+			else
+				bytes[i] = old;
+		}
+	}
+
+	return size;
+}
+
+static void report(verify_state* vs, const char* what, const uint8_t* bytes, size_t size, mismatch_fn fn)
+{
+	uint8_t tmp[MAX_INSN];
+
+	if (++vs->mismatches > vs->max_reports)
+		return;
+
+	memcpy(tmp, bytes, size);
+	size_t n = fn ? shrink(vs, tmp, size, fn) : size;
+
+	printf("mismatch (%s, %s): ", vs->is64 ? "x86-64" : "x86", what);
+	print_bytes(tmp, n);
+	printf("\n");
+}
+
+/* single instruction: bounded decoder against the reference, with a guard page behind it */
+static bool single_mismatch(verify_state* vs, const uint8_t* bytes, size_t size)
+{
+	ldasm_insn ref, ld;
+	uint8_t buf[MAX_INSN * 2] = { 0 };
+
+	memcpy(buf, bytes, size);
+	size_t len = ldasm(buf, NULL, &ref, vs->is64);
+	if (!len || len > MAX_INSN)
+		return true;
+
+	uint8_t* at = vs->guard - len;
+	memcpy(at, buf, len);
+	if (ldasm_ex(at, len, NULL, &ld, vs->is64) != len || memcmp(&ref, &ld, sizeof(ld)))
+		return true;
+
+	at = vs->guard - (len - 1);
+	memcpy(at, buf, len - 1);
+	return ldasm_ex(at, len - 1, NULL, &ld, vs->is64) != LDASM_TRUNCATED;
+}
+
+/* every batch path cut short at cap must stop where ldasm_sweep does, after want bytes */
+static bool cap_mismatch(verify_state* vs, const uint8_t* stream, size_t len, size_t cap, size_t want)
+{
+	size_t consumed, c[5], n[5];
+
+	if (ldasm_sweep(stream, len, NULL, vs->is64, NULL, NULL, cap, &consumed) != cap || consumed != want)
+		return true;
+
+	ldasm_soa soa = { .length = vs->lengths, .flags = vs->lengths + STREAM_SIZE };
+	n[0] = ldasm_sweep_lengths(stream, len, NULL, vs->is64, vs->lengths, cap, &c[0]);
+	n[1] = ldasm_sweep_parallel(stream, len, NULL, vs->is64, vs->out, vs->lengths, cap, &c[1], SWEEP_THREADS);
+	n[2] = ldasm_sweep_parallel(stream, len, NULL, vs->is64, NULL, NULL, cap, &c[2], SWEEP_THREADS);
+	n[3] = ldasm_sweep_soa(stream, len, NULL, vs->is64, &soa, cap, &c[3]);
+	n[4] = ldasm_sweep_packed(stream, len, NULL, vs->is64, vs->packed, cap, &c[4]);
+
+	for (size_t i = 0; i < 5; i++) {
+		if (n[i] != cap || c[i] != consumed)
+			return true;
+	}
+
+	return false;
+}
+
+/* caps below count: one, half, all but one, and the first instruction of every parallel chunk but the first */
+static size_t short_caps(size_t count, size_t len, size_t (*before)(const void* ctx, size_t offset), const void* ctx,
+	size_t caps[SHORT_CAPS])
+{
+	size_t n = 0;
+
+	caps[n++] = 1;
+	caps[n++] = count / 2;
+	caps[n++] = count - 1;
+
+	/* chunk borders as ldasm_sweep_parallel() places them, cap lands right at a chunk end */
+	for (size_t i = 1; i < SWEEP_THREADS && len / SWEEP_THREADS >= 64 * 1024; i++)
+		caps[n++] = before(ctx, (len / SWEEP_THREADS * i) & ~(size_t)63);
+
+	for (size_t i = 0; i < n; i++) {
+		if (caps[i] >= count)
+			caps[i] = count - 1;
+	}
+
+	return n;
+}
+
+/* instructions of a repeated one starting below offset */
+static size_t repeated_before(const void* ctx, size_t offset)
+{
+	size_t len = *(const size_t*)ctx;
+	return (offset + len - 1) / len;
+}
+
+/* enumerated instructions starting below offset */
+static size_t stream_before(const void* ctx, size_t offset)
+{
+	const verify_state* vs = (const verify_state*)ctx;
+	size_t pos = 0, i = 0;
+
+	for (; i < vs->count && pos < offset; i++)
+		pos += vs->insns[i].size;
+
+	return i;
+}
+
+/* batch paths over a stream built by repeating the instruction */
+static bool stream_mismatch(verify_state* vs, const uint8_t* bytes, size_t size)
+{
+	ldasm_insn ref;
+	uint8_t buf[MAX_INSN * 2] = { 0 };
+
+	memcpy(buf, bytes, size);
+	size_t len = ldasm(buf, NULL, &ref, vs->is64);
+	if (!len || len > MAX_INSN)
+		return true;
+
+	size_t total = 0, count = 0;
+	while (total + len <= STREAM_SIZE) {
+		memcpy(vs->stream + total, buf, len);
+		total += len;
+		++count;
+	}
+
+	size_t c1, c2, c3;
+	size_t n1 = ldasm_sweep(vs->stream, total, NULL, vs->is64, vs->out, vs->lengths, count, &c1);
+	if (n1 != count || c1 != total)
+		return true;
+
+	for (size_t i = 0; i < n1; i++) {
+		if (vs->lengths[i] != len || memcmp(&vs->out[i], &ref, sizeof(ref)))
+			return true;
+	}
+
+	size_t n2 = ldasm_sweep_lengths(vs->stream, total, NULL, vs->is64, vs->lengths, count, &c2);
+	size_t n3 = ldasm_sweep_parallel(vs->stream, total, NULL, vs->is64, NULL, vs->lengths + count, count, &c3, SWEEP_THREADS);
+	if (n2 != count || c2 != total || n3 != count || c3 != total)
+		return true;
+
+	for (size_t i = 0; i < count; i++) {
+		if (vs->lengths[i] != len || vs->lengths[count + i] != len)
+			return true;
+	}
+
+	ldasm_soa soa = { .length = vs->lengths, .flags = vs->lengths + count };
+	uint32_t packed = ldasm_pack(&ref, len);
+	size_t n4 = ldasm_sweep_soa(vs->stream, total, NULL, vs->is64, &soa, count, &c1);
+	size_t n5 = ldasm_sweep_packed(vs->stream, total, NULL, vs->is64, vs->packed, count, &c2);
+	if (n4 != count || c1 != total || n5 != count || c2 != total)
+		return true;
+
+	for (size_t i = 0; i < count; i++) {
+		if (soa.length[i] != len || soa.flags[i] != ref.flags || vs->packed[i] != packed)
+			return true;
+	}
+
+	size_t caps[SHORT_CAPS];
+	size_t ncaps = count > 1 ? short_caps(count, total, repeated_before, &len, caps) : 0;
+	for (size_t i = 0; i < ncaps; i++) {
+		if (cap_mismatch(vs, vs->stream, total, caps[i], caps[i] * len))
+			return true;
+	}
+
+	return false;
+}
+
+/* compare every batch path on the accumulated stream with the reference records */
+static void flush_stream(verify_state* vs)
+{
+	size_t consumed;
+	size_t n, bad = SIZE_MAX;
+
+	if (!vs->count)
+		return;
+
+	n = ldasm_sweep(vs->stream, vs->stream_len, NULL, vs->is64, vs->out, vs->lengths, vs->count, &consumed);
+	for (size_t i = 0; i < n && bad == SIZE_MAX; i++) {
+		if (vs->lengths[i] != vs->insns[i].size || memcmp(&vs->out[i], &vs->insns[i].ld, sizeof(ldasm_insn)))
+			bad = i;
+	}
+	if (bad == SIZE_MAX && (n != vs->count || consumed != vs->stream_len))
+		bad = n < vs->count ? n : 0;
+
+	if (bad == SIZE_MAX) {
+		n = ldasm_sweep_lengths(vs->stream, vs->stream_len, NULL, vs->is64, vs->lengths, vs->count, &consumed);
+		for (size_t i = 0; i < n && bad == SIZE_MAX; i++) {
+			if (vs->lengths[i] != vs->insns[i].size)
+				bad = i;
+		}
+		if (bad == SIZE_MAX && (n != vs->count || consumed != vs->stream_len))
+			bad = n < vs->count ? n : 0;
+	} //if
+
+	if (bad == SIZE_MAX) {
+		n = ldasm_sweep_parallel(vs->stream, vs->stream_len, NULL, vs->is64, vs->out, vs->lengths, vs->count, &consumed, SWEEP_THREADS);
+		for (size_t i = 0; i < n && bad == SIZE_MAX; i++) {
+			if (vs->lengths[i] != vs->insns[i].size || memcmp(&vs->out[i], &vs->insns[i].ld, sizeof(ldasm_insn)))
+				bad = i;
+		}
+		if (bad == SIZE_MAX && (n != vs->count || consumed != vs->stream_len))
+			bad = n < vs->count ? n : 0;
+	} //if
+
+	if (bad == SIZE_MAX) {
+		ldasm_soa soa = { .length = vs->lengths, .flags = vs->lengths + STREAM_SIZE };
+		n = ldasm_sweep_soa(vs->stream, vs->stream_len, NULL, vs->is64, &soa, vs->count, &consumed);
+		for (size_t i = 0; i < n && bad == SIZE_MAX; i++) {
+			if (soa.length[i] != vs->insns[i].size || soa.flags[i] != vs->insns[i].ld.flags)
+				bad = i;
+		}
+		if (bad == SIZE_MAX && (n != vs->count || consumed != vs->stream_len))
+			bad = n < vs->count ? n : 0;
+	} //if
+
+	if (bad == SIZE_MAX) {
+		n = ldasm_sweep_packed(vs->stream, vs->stream_len, NULL, vs->is64, vs->packed, vs->count, &consumed);
+		for (size_t i = 0; i < n && bad == SIZE_MAX; i++) {
+			if (vs->packed[i] != ldasm_pack(&vs->insns[i].ld, vs->insns[i].size))
+				bad = i;
+		}
+		if (bad == SIZE_MAX && (n != vs->count || consumed != vs->stream_len))
+			bad = n < vs->count ? n : 0;
+	} //if
+
+	if (bad == SIZE_MAX && vs->count > 1) {
+		size_t caps[SHORT_CAPS];
+		size_t ncaps = short_caps(vs->count, vs->stream_len, stream_before, vs, caps);
+
+		for (size_t i = 0; i < ncaps && bad == SIZE_MAX; i++) {
+			size_t want = 0;
+			for (size_t j = 0; j < caps[i]; j++)
+				want += vs->insns[j].size;
+			if (cap_mismatch(vs, vs->stream, vs->stream_len, caps[i], want))
+				bad = caps[i] - 1;
+		}
+	} //if
+
+	/* the stream is only used to find a suspect, the report is shrunk on a stream of its own */
+	if (bad != SIZE_MAX) {
+		verify_insn suspect = vs->insns[bad];
+		report(vs, "batch paths", suspect.bytes, suspect.size, stream_mismatch);
+	} //if
+
+	vs->count = 0;
+	vs->stream_len = 0;
+}
+
+static void check(verify_state* vs, const uint8_t* bytes, size_t size)
+{
+	verify_insn insn;
+
+	memset(&insn, 0, sizeof(insn));
+	memcpy(insn.bytes, bytes, size);
+
+	size_t len = ldasm(insn.bytes, NULL, &insn.ld, vs->is64);
+	if (!len || len > MAX_INSN)
+		return;
+
+	insn.size = (uint8_t)len;
+	++vs->checked;
+
+	if (single_mismatch(vs, insn.bytes, len))
+		report(vs, "ldasm_ex", insn.bytes, len, single_mismatch);
+
+	if (vs->stream_len + len > STREAM_SIZE)
+		flush_stream(vs);
+
+	memcpy(vs->stream + vs->stream_len, insn.bytes, len);
+	vs->stream_len += len;
+	vs->insns[vs->count++] = insn;
+}
+
+/* a representative subset of every opcode goes to objdump, one instruction per slot */
+static void add_slot(verify_state* vs, const uint8_t* bytes, size_t size)
+{
+	ldasm_insn ld;
+	uint8_t buf[OBJDUMP_SLOT];
+
+	memset(buf, 0x90, sizeof(buf));
+	memcpy(buf, bytes, size);
+
+	size_t len = ldasm(buf, NULL, &ld, vs->is64);
+	if (len >= OBJDUMP_SLOT || (ld.flags & DF_INVALID))
+		return;
+
+	/* zero the displacement and immediate so every slot is deterministic */
+	memset(buf + size, 0, len > size ? len - size : 0);
+
+	if (vs->slot_count == vs->slot_cap) {
+		size_t cap = vs->slot_cap ? vs->slot_cap * 2 : 4096;
+		verify_insn* p = realloc(vs->slot_insns, cap * sizeof(verify_insn));
+		if (!p)
+			return;
+		vs->slot_insns = p;
+		vs->slot_cap = cap;
+	} //if
+
+	verify_insn* insn = &vs->slot_insns[vs->slot_count++];
+	memcpy(insn->bytes, buf, MAX_INSN);
+	insn->size = (uint8_t)len;
+	insn->ld = ld;
+
+	fwrite(buf, 1, sizeof(buf), vs->slots);
+}
+
+static bool slot_representative(uint8_t modrm, uint8_t sib)
+{
+	uint8_t mod = modrm >> 6, rm = modrm & 7;
+
+	if (rm != 0 && rm != 4 && rm != 5)
+		return false;
+	if (mod == 3 && rm != 0)
+		return false;
+
+	return sib == 0 || sib == 0x24 || sib == 0x25;
+}
+
+/* enumerate ModR/M and SIB for one prefix + opcode */
+static void enumerate_operands(verify_state* vs, const uint8_t* head, size_t size)
+{
+	uint8_t buf[MAX_INSN] = { 0 };
+	ldasm_insn ld;
+
+	memcpy(buf, head, size);
+	ldasm(buf, NULL, &ld, vs->is64);
+
+	if (!(ld.flags & DF_MODRM)) {
+		check(vs, buf, size);
+		if (vs->slots)
+			add_slot(vs, buf, size);
+		return;
+	} //if
+
+	for (int modrm = 0; modrm < 256; modrm++) {
+		buf[size] = (uint8_t)modrm;
+		buf[size + 1] = 0;
+		ldasm(buf, NULL, &ld, vs->is64);
+
+		int sibs = (ld.flags & DF_SIB) ? 256 : 1;
+		for (int sib = 0; sib < sibs; sib++) {
+			buf[size + 1] = (uint8_t)sib;
+			check(vs, buf, size + 1 + (sibs > 1));
+			if (vs->slots && slot_representative((uint8_t)modrm, (uint8_t)sib))
+				add_slot(vs, buf, size + 1 + (sibs > 1));
+		}
+	}
+}
+
+static bool is_prefix(verify_state* vs, uint8_t b)
+{
+	const ldasm_tables* t = ldasm_default_tables();
+	return (t->flags[b] & OP_PREFIX) || (vs->is64 && (b >> 4) == 4);
+}
+
+/* enumerate one-byte opcodes, 0F xx, and the three-byte maps behind it */
+static void enumerate_opcodes(verify_state* vs, const uint8_t* prefix, size_t size, bool vex, bool objdump)
+{
+	uint8_t buf[MAX_INSN] = { 0 };
+	ldasm_insn ld;
+	FILE* slots = vs->slots;
+
+	/* objdump only gets the unprefixed and single-prefix forms */
+	if (!objdump)
+		vs->slots = NULL;
+
+	memcpy(buf, prefix, size);
+
+	for (int op = 0; op < 256; op++) {
+		/* behind a VEX/EVEX/XOP prefix every byte is an opcode of the selected map */
+		if (!vex && is_prefix(vs, (uint8_t)op))
+			continue;
+
+		buf[size] = (uint8_t)op;
+		if (op != 0x0F || vex) {
+			enumerate_operands(vs, buf, size + 1);
+			continue;
+		} //if
+
+		for (int op2 = 0; op2 < 256; op2++) {
+			buf[size + 1] = (uint8_t)op2;
+			buf[size + 2] = 0;
+			ldasm(buf, NULL, &ld, vs->is64);
+
+			if (ld.opcd_size < 3) {
+				enumerate_operands(vs, buf, size + 2);
+				continue;
+			} //if
+
+			for (int op3 = 0; op3 < 256; op3++) {
+				buf[size + 2] = (uint8_t)op3;
+				enumerate_operands(vs, buf, size + 3);
+			}
+		}
+	}
+
+	vs->slots = slots;
+}
+
+typedef struct _verify_prefix
+{
+	uint8_t bytes[4];
+	uint8_t size;
+	bool    only64;
+	bool    vex;
+	bool    objdump;
+} verify_prefix;
+
+static void enumerate_mode(verify_state* vs, bool objdump)
+{
+	static const verify_prefix prefixes[] = {
+		{ { 0 }, 0, false, false, true },
+		{ { 0x66 }, 1, false, false, true },
+		{ { 0x67 }, 1, false, false, false },
+		{ { 0xF2 }, 1, false, false, false },
+		{ { 0xF3 }, 1, false, false, true },
+		{ { 0xF0 }, 1, false, false, false },
+		{ { 0x2E }, 1, false, false, false },
+		{ { 0x66, 0x67 }, 2, false, false, false },
+		{ { 0x40 }, 1, true, false, false },
+		{ { 0x48 }, 1, true, false, true },
+		{ { 0x66, 0x48 }, 2, true, false, false },
+		{ { 0x41 }, 1, true, false, false },
+
+		/* VEX 0F, 0F38 and 0F3A maps, EVEX maps 1-3, XOP maps 8-A */
+		{ { 0xC5, 0xF8 }, 2, false, true, true },
+		{ { 0xC4, 0xE2, 0x79 }, 3, false, true, true },
+		{ { 0xC4, 0xE3, 0x79 }, 3, false, true, true },
+		{ { 0x62, 0xF1, 0x7C, 0x48 }, 4, false, true, true },
+		{ { 0x62, 0xF2, 0x7D, 0x48 }, 4, false, true, true },
+		{ { 0x62, 0xF3, 0x7D, 0x48 }, 4, false, true, true },
+		{ { 0x8F, 0xE8, 0x78 }, 3, false, true, true },
+		{ { 0x8F, 0xE9, 0x78 }, 3, false, true, true },
+		{ { 0x8F, 0xEA, 0x78 }, 3, false, true, true },
+	};
+
+	for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+		const verify_prefix* pr = &prefixes[i];
+		if (pr->only64 && !vs->is64)
+			continue;
+		enumerate_opcodes(vs, pr->bytes, pr->size, pr->vex, objdump && pr->objdump);
+	}
+
+	flush_stream(vs);
+}
+
+/* run objdump over the slots and compare the length of the first instruction of every slot */
+static void compare_objdump(verify_state* vs, const char* path)
+{
+	char cmd[512];
+	char line[1024];
+
+	fflush(vs->slots);
+	snprintf(cmd, sizeof(cmd), "objdump -D -w -b binary -m %s %s 2>/dev/null",
+		vs->is64 ? "i386:x86-64" : "i386", path);
+
+	FILE* p = popen(cmd, "r");
+	if (!p) {
+		printf("objdump is not available\n");
+		return;
+	} //if
+
+	size_t slot = 0, slot_start = SIZE_MAX, compared = 0, differ = 0, last_key = 0;
+	uint8_t last[MAX_INSN];
+	bool bad = false;
+
+	while (fgets(line, sizeof(line), p) && slot < vs->slot_count) {
+		char* end;
+		unsigned long addr = strtoul(line, &end, 16);
+		if (end == line || *end != ':' || line[0] != ' ')
+			continue;
+
+		/* first instruction after the current slot start gives its length */
+		if (slot_start != SIZE_MAX && addr > slot_start) {
+			verify_insn* insn = &vs->slot_insns[slot];
+			if (!bad) {
+				++compared;
+				if (addr - slot_start != insn->size) {
+					/* slots come grouped by opcode, report every opcode once */
+					size_t key = (size_t)insn->ld.opcd_offset + insn->ld.opcd_size;
+					bool seen = key == last_key && !memcmp(last, insn->bytes, key);
+					memcpy(last, insn->bytes, key);
+					last_key = key;
+					++differ;
+					if (!seen && ++vs->mismatches <= vs->max_reports) {
+						printf("mismatch (%s, objdump %lu, ldasm %u): ", vs->is64 ? "x86-64" : "x86",
+							addr - slot_start, insn->size);
+						print_bytes(insn->bytes, addr - slot_start > insn->size ? addr - slot_start : insn->size);
+						printf("\n");
+					} //if
+				} //if
+			} //if
+			++slot;
+			slot_start = SIZE_MAX;
+		} //if
+
+		if (slot_start == SIZE_MAX && addr == slot * OBJDUMP_SLOT) {
+			slot_start = addr;
+			bad = strstr(line, "(bad)") != NULL;
+		} //if
+	}
+
+	pclose(p);
+	printf("objdump: %zu lengths compared, %zu differ\n", compared, differ);
+}
+
+int ldasm_verify(bool objdump, unsigned max_reports)
+{
+	verify_state vs = { 0 };
+	size_t total_mismatches = 0;
+
+	vs.max_reports = max_reports;
+	vs.page = (size_t)sysconf(_SC_PAGESIZE);
+
+	uint8_t* pages = mmap(NULL, vs.page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pages == MAP_FAILED)
+		return 2;
+	mprotect(pages + vs.page, vs.page, PROT_NONE);
+	vs.guard = pages + vs.page;
+
+	vs.stream = malloc(STREAM_SIZE + MAX_INSN);
+	vs.insns = malloc(STREAM_SIZE * sizeof(verify_insn));
+	vs.lengths = malloc(STREAM_SIZE * 2);
+	vs.out = malloc(STREAM_SIZE * sizeof(ldasm_insn));
+	vs.packed = malloc(STREAM_SIZE * sizeof(uint32_t));
+	if (!vs.stream || !vs.insns || !vs.lengths || !vs.out || !vs.packed)
+		return 2;
+
+	for (int mode = 0; mode < 2; mode++) {
+		char path[] = "/tmp/ldasm-verify-XXXXXX";
+		int fd = -1;
+
+		vs.is64 = mode == 1;
+		vs.checked = 0;
+		vs.mismatches = 0;
+		vs.slot_count = 0;
+
+		if (objdump && (fd = mkstemp(path)) >= 0)
+			vs.slots = fdopen(fd, "wb");
+
+		enumerate_mode(&vs, objdump);
+		printf("%s: %zu encodings checked, %zu mismatches\n", vs.is64 ? "x86-64" : "x86", vs.checked, vs.mismatches);
+
+		if (vs.slots) {
+			compare_objdump(&vs, path);
+			fclose(vs.slots);
+			vs.slots = NULL;
+			unlink(path);
+		} //if
+
+		total_mismatches += vs.mismatches;
+	}
+
+	free(vs.slot_insns);
+	free(vs.packed);
+	free(vs.out);
+	free(vs.lengths);
+	free(vs.insns);
+	free(vs.stream);
+	munmap(pages, vs.page * 2);
+
+	return total_mismatches ? 1 : 0;
+}
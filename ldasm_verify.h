@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ldasm.h"
+
+/**
+ * @brief Exhaustive differential check of all decoder paths against ldasm() (used by ldasm-scan --verify)
+ *
+ * Optionally compares lengths with objdump when it is installed. At most max_reports mismatches
+ * per mode are printed, each shrunk to a minimal byte string.
+ *
+ * @return 0 if all paths agree, 1 on mismatches, 2 on setup failure
+ */
+int ldasm_verify(bool objdump, unsigned max_reports);
@@ -0,0 +1,300 @@
+#include "ldasm_xref.h"
+#include "ldasm_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-reference extraction.
+//
+// Regions are swept in batches of packed instructions, which carry exactly the flags, length and
+// offsets needed to resolve a DF_RELATIVE operand: a rel8/16/32 branch immediate, or a RIP-relative
+// displacement (ModR/M mod 0, rm 5, which never has a SIB byte in between). References are
+// appended as found. Finishing sorts them by source, which is a no-op when regions were added in
+// address order, and builds the inverse index with a stable radix sort on the target.
+
+#define BATCH       1024
+#define RADIX_BITS  8
+
+typedef struct _radix_item
+{
+	uint64_t key;
+	uint32_t index;
+} radix_item;
+
+static bool push(ldasm_xrefs* xrefs, uint64_t source, uint64_t target, uint32_t kind)
+{
+	if (xrefs->count == xrefs->cap) {
+		size_t cap = xrefs->cap ? xrefs->cap * 2 : 4096;
+		ldasm_xref* refs = realloc(xrefs->refs, cap * sizeof(ldasm_xref));
+		if (!refs)
+			return false;
+		xrefs->refs = refs;
+		xrefs->cap = cap;
+	} //if
+
+	xrefs->refs[xrefs->count++] = (ldasm_xref){ .source = source, .target = target, .kind = kind };
+	return true;
+}
+
+static int64_t read_rel(const uint8_t* p, size_t size)
+{
+	int32_t v32;
+	int16_t v16;
+
+	switch (size) {
+	case 1:
+		return (int8_t)*p;
+	case 2:
+		memcpy(&v16, p, 2);
+		return v16;
+	case 4:
+		memcpy(&v32, p, 4);
+		return v32;
+	default:
+		return 0;
+	}
+}
+
+/* a 67 among the legacy prefixes, which stop at REX or a VEX/EVEX/XOP escape */
+static bool has_addr_size(const uint8_t* insn, size_t opcd_offset)
+{
+	for (size_t i = 0; i < opcd_offset; i++) {
+		switch (insn[i]) {
+		case 0x67:
+			return true;
+		case 0x26: case 0x2E: case 0x36: case 0x3E: case 0x64: case 0x65:
+		case 0x66: case 0xF0: case 0xF2: case 0xF3:
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+/* kind of a relative branch, -1 if the opcode is not one */
+static int branch_kind(const uint8_t* op)
+{
+	if (op[0] == 0x0F)
+		return op[1] >= 0x80 && op[1] <= 0x8F ? LDASM_XREF_JCC : -1;
+	if (op[0] == 0xE8)
+		return LDASM_XREF_CALL;
+	if (op[0] == 0xE9 || op[0] == 0xEB)
+		return LDASM_XREF_JMP;
+	if ((op[0] >= 0x70 && op[0] <= 0x7F) || (op[0] >= 0xE0 && op[0] <= 0xE3))
+		return LDASM_XREF_JCC;
+	return -1;
+}
+
+bool ldasm_xrefs_scan(ldasm_xrefs* xrefs, const void* code, size_t len, uint64_t addr,
+	const ldasm_tables* tables, bool is64)
+{
+	const uint8_t* p = (const uint8_t*)code;
+	uint32_t packed[BATCH];
+	size_t pos = 0, consumed;
+
+	if (!xrefs || !p)
+		return false;
+
+	while (pos < len) {
+		size_t n = ldasm_sweep_packed(p + pos, len - pos, tables, is64, packed, BATCH, &consumed);
+
+		for (size_t i = 0; i < n; i++) {
+			const uint32_t v = packed[i];
+			const uint8_t* insn = p + pos;
+			const uint8_t flags = LDASM_PACKED_FLAGS(v);
+			const size_t length = LDASM_PACKED_LENGTH(v);
+
+			pos += length;
+
+			if ((flags & (DF_RELATIVE | DF_INVALID)) != DF_RELATIVE)
+				continue;
+
+			const uint64_t source = addr + (uint64_t)(insn - p);
+			const uint64_t next = source + length;
+			const size_t disp = LDASM_PACKED_DISP_OFFSET(v);
+			uint64_t target;
+			int kind;
+
+			if (is64 && (flags & DF_DISP) && (insn[disp - 1] & 0xC7) == 0x05) {
+				target = next + (uint64_t)read_rel(insn + disp, 4);
+				/* with a 67 prefix the displacement is relative to EIP */
+				if ((flags & DF_PREFIX) && has_addr_size(insn, LDASM_PACKED_OPCD_OFFSET(v)))
+					target &= 0xFFFFFFFFu;
+				kind = insn[LDASM_PACKED_OPCD_OFFSET(v)] == 0x8D ? LDASM_XREF_ADDR : LDASM_XREF_DATA;
+			}
+			else if (flags & DF_IMM) {
+				const size_t imm_size = LDASM_PACKED_IMM_SIZE(v);
+
+				kind = branch_kind(insn + LDASM_PACKED_OPCD_OFFSET(v));
+				if (kind < 0)
+					continue;
+
+				target = next + (uint64_t)read_rel(insn + LDASM_PACKED_IMM_OFFSET(v), imm_size);
+				/* a 16-bit operand size truncates the instruction pointer */
+				if (imm_size == 2)
+					target &= 0xFFFF;
+			}
+			else {
+				continue;
+			} //if
+
+			if (!is64)
+				target &= 0xFFFFFFFFu;
+
+			if (!push(xrefs, source, target, (uint32_t)kind))
+				return false;
+		}
+
+		if (n < BATCH)
+			break;
+	}
+
+	return true;
+}
+
+static int compare_xref(const void* a, const void* b)
+{
+	const ldasm_xref* x = (const ldasm_xref*)a;
+	const ldasm_xref* y = (const ldasm_xref*)b;
+
+	if (x->source != y->source)
+		return x->source < y->source ? -1 : 1;
+	if (x->target != y->target)
+		return x->target < y->target ? -1 : 1;
+	return (x->kind > y->kind) - (x->kind < y->kind);
+}
+
+/* LSD radix sort, stable, digits every key shares are skipped, returns the buffer holding the result */
+static radix_item* radix_sort(radix_item* items, radix_item* tmp, size_t n)
+{
+	for (unsigned shift = 0; shift < 64; shift += RADIX_BITS) {
+		size_t counts[1u << RADIX_BITS] = { 0 };
+
+		for (size_t i = 0; i < n; i++)
+			++counts[(items[i].key >> shift) & ((1u << RADIX_BITS) - 1)];
+
+		if (counts[(items[0].key >> shift) & ((1u << RADIX_BITS) - 1)] == n)
+			continue;
+
+		for (size_t d = 0, sum = 0; d < (1u << RADIX_BITS); d++) {
+			size_t c = counts[d];
+			counts[d] = sum;
+			sum += c;
+		}
+
+		for (size_t i = 0; i < n; i++)
+			tmp[counts[(items[i].key >> shift) & ((1u << RADIX_BITS) - 1)]++] = items[i];
+
+		radix_item* swap = items;
+		items = tmp;
+		tmp = swap;
+	}
+
+	return items;
+}
+
+bool ldasm_xrefs_finish(ldasm_xrefs* xrefs)
+{
+	if (!xrefs)
+		return false;
+
+	size_t n = xrefs->count;
+
+	for (size_t i = 1; i < n; i++) {
+		if (compare_xref(&xrefs->refs[i - 1], &xrefs->refs[i]) > 0) {
+			qsort(xrefs->refs, n, sizeof(ldasm_xref), compare_xref);
+			break;
+		} //if
+	}
+
+	size_t unique = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (!unique || compare_xref(&xrefs->refs[unique - 1], &xrefs->refs[i]) != 0)
+			xrefs->refs[unique++] = xrefs->refs[i];
+	}
+	xrefs->count = n = unique;
+
+	free(xrefs->by_target);
+	xrefs->by_target = NULL;
+
+	if (!n)
+		return true;
+	if (n > UINT32_MAX)
+		return false;
+
+	radix_item* items = malloc(2 * n * sizeof(radix_item));
+	xrefs->by_target = malloc(n * sizeof(uint32_t));
+	if (!items || !xrefs->by_target) {
+		free(items);
+		free(xrefs->by_target);
+		xrefs->by_target = NULL;
+		return false;
+	} //if
+
+	/* refs are in source order, so equal targets stay in source order */
+	for (size_t i = 0; i < n; i++)
+		items[i] = (radix_item){ .key = xrefs->refs[i].target, .index = (uint32_t)i };
+
+	const radix_item* sorted = radix_sort(items, items + n, n);
+	for (size_t i = 0; i < n; i++)
+		xrefs->by_target[i] = sorted[i].index;
+
+	free(items);
+	return true;
+}
+
+const ldasm_xref* ldasm_xrefs_from(const ldasm_xrefs* xrefs, uint64_t source, size_t* count)
+{
+	size_t lo = 0, hi = xrefs ? xrefs->count : 0;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (xrefs->refs[mid].source < source)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	size_t end = lo;
+	while (xrefs && end < xrefs->count && xrefs->refs[end].source == source)
+		++end;
+
+	if (count)
+		*count = end - lo;
+
+	return end > lo ? &xrefs->refs[lo] : NULL;
+}
+
+const uint32_t* ldasm_xrefs_to(const ldasm_xrefs* xrefs, uint64_t target, size_t* count)
+{
+	size_t lo = 0, hi = xrefs && xrefs->by_target ? xrefs->count : 0;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (xrefs->refs[xrefs->by_target[mid]].target < target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	size_t end = lo;
+	while (xrefs && xrefs->by_target && end < xrefs->count && xrefs->refs[xrefs->by_target[end]].target == target)
+		++end;
+
+	if (count)
+		*count = end - lo;
+
+	return end > lo ? &xrefs->by_target[lo] : NULL;
+}
+
+void ldasm_xrefs_free(ldasm_xrefs* xrefs)
+{
+	if (!xrefs)
+		return;
+
+	free(xrefs->refs);
+	free(xrefs->by_target);
+	memset(xrefs, 0, sizeof(*xrefs));
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ldasm.h"
+
+typedef enum _ldasm_xref_kind
+{
+	LDASM_XREF_CALL,        /* call rel */
+	LDASM_XREF_JMP,         /* jmp rel */
+	LDASM_XREF_JCC,         /* jcc, loop and jcxz rel */
+	LDASM_XREF_DATA,        /* RIP-relative memory operand */
+	LDASM_XREF_ADDR,        /* lea of a RIP-relative address */
+} ldasm_xref_kind;
+
+typedef struct _ldasm_xref
+{
+	uint64_t source;        /* address of the referencing instruction */
+	uint64_t target;
+	uint32_t kind;          /* ldasm_xref_kind */
+} ldasm_xref;
+
+typedef struct _ldasm_xrefs
+{
+	ldasm_xref* refs;       /* sorted by source, target and kind after ldasm_xrefs_finish(), no duplicates */
+	size_t      count;
+	size_t      cap;
+	uint32_t*   by_target;  /* indices into refs sorted by target, then source */
+} ldasm_xrefs;
+
+/**
+ * @brief Add the references of a code region loaded at addr, zero-initialize xrefs before the first call
+ *
+ * Decodes the region linearly. Invalid instructions are skipped and decoding stops before an
+ * instruction cut off by the end of the region.
+ *
+ * @return false if memory ran out
+ */
+bool ldasm_xrefs_scan(ldasm_xrefs* xrefs, const void* code, size_t len, uint64_t addr,
+	const ldasm_tables* tables, bool is64);
+
+/**
+ * @brief Sort and deduplicate the references added so far and build the inverse index
+ */
+bool ldasm_xrefs_finish(ldasm_xrefs* xrefs);
+
+/**
+ * @brief References made by the instruction at source (after ldasm_xrefs_finish())
+ * @return First reference, count stores how many follow it
+ */
+const ldasm_xref* ldasm_xrefs_from(const ldasm_xrefs* xrefs, uint64_t source, size_t* count);
+
+/**
+ * @brief Who references target (after ldasm_xrefs_finish())
+ * @return Indices into refs, count stores how many
+ */
+const uint32_t* ldasm_xrefs_to(const ldasm_xrefs* xrefs, uint64_t target, size_t* count);
+
+/**
+ * @brief Release the arrays
+ */
+void ldasm_xrefs_free(ldasm_xrefs* xrefs);
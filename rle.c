@@ -1,5 +1,7 @@
 #include "rle.h"
 
+#include <string.h>
+
 size_t compress_rle(uint8_t* out, const uint8_t* in, size_t in_size) {
     size_t in_pos = 0, out_pos = 0;
     uint8_t ctrl_byte = 0;
@@ -56,9 +58,8 @@ size_t decompress_rle(uint8_t* out, const uint8_t* in, size_t in_size) {
                 if (in_pos + 1 >= in_size) break;
                 uint8_t count = in[in_pos++];
                 uint8_t sym = in[in_pos++];
-                for (uint8_t i = 0; i < count; i++) {
-                    out[out_pos++] = sym;
-                }
+                memset(out + out_pos, sym, count);
+                out_pos += count;
             } else {
                 // literal byte
                 if (in_pos >= in_size) break;
@@ -69,3 +70,175 @@ size_t decompress_rle(uint8_t* out, const uint8_t* in, size_t in_size) {
 
     return out_pos;
 }
+
+// Bounded and streaming variants.
+//
+// The streaming decoder is a small state machine that can stop after any byte, which makes it the
+// exact path for the ends of the buffers. Everywhere else whole groups are decoded without per-byte
+// checks: a group of 8 literals is one 8-byte copy, and a run is stored 16 bytes at a time from a
+// broadcast symbol, as long as the output has room for 8 of the longest runs plus one store.
+
+#define RLE_MAX_RUN 255
+#define RLE_WIDE    16
+
+size_t compress_rle_bound(size_t in_size) {
+    // all literals: one control byte per 8 of them, plus the one compress_rle() may leave unused
+    return in_size + (in_size + 7) / 8 + 1;
+}
+
+size_t compress_rle_ex(uint8_t* out, size_t out_cap, const uint8_t* in, size_t in_size) {
+    size_t in_pos = 0, out_pos = 0, ctrl_pos = 0;
+    uint8_t ctrl_byte = 0;
+    int bit_index = 8;
+
+    while (in_pos < in_size) {
+        // open a new group only when a block follows
+        if (bit_index == 8) {
+            if (out_pos == out_cap) return RLE_ERROR;
+            ctrl_pos = out_pos++;
+            ctrl_byte = 0;
+            bit_index = 0;
+        }
+
+        size_t run_len = 1;
+        size_t max_run = in_size - in_pos < RLE_MAX_RUN ? in_size - in_pos : RLE_MAX_RUN;
+        while (run_len < max_run && in[in_pos + run_len] == in[in_pos]) {
+            run_len++;
+        }
+
+        if (run_len >= 2) {
+            if (out_cap - out_pos < 2) return RLE_ERROR;
+            ctrl_byte |= (uint8_t)(1 << bit_index);
+            out[out_pos++] = (uint8_t)run_len;
+            out[out_pos++] = in[in_pos];
+            in_pos += run_len;
+        } else {
+            if (out_pos == out_cap) return RLE_ERROR;
+            out[out_pos++] = in[in_pos++];
+        }
+
+        out[ctrl_pos] = ctrl_byte;
+        bit_index++;
+    }
+
+    return out_pos;
+}
+
+void rle_stream_init(rle_stream* stream) {
+    stream->ctrl = 0;
+    stream->bit = 8;
+    stream->pending = 0;
+    stream->count = 0;
+    stream->sym = 0;
+    stream->left = 0;
+}
+
+int rle_stream_done(const rle_stream* stream) {
+    return !stream->pending && !stream->left;
+}
+
+static inline void store_run(uint8_t* out, uint8_t sym, size_t count) {
+    uint64_t wide = sym * 0x0101010101010101ull;
+
+    // rounded up to whole stores, the caller left room for them
+    for (size_t i = 0; i < count; i += RLE_WIDE) {
+        memcpy(out + i, &wide, 8);
+        memcpy(out + i + 8, &wide, 8);
+    }
+}
+
+// whole groups while the input holds the largest one and the output its longest expansion plus a store
+static void expand_blocks(rle_stream* s, uint8_t* out, size_t out_cap, size_t* out_pos,
+                          const uint8_t* in, size_t in_size, size_t* in_pos) {
+    size_t ip = *in_pos, op = *out_pos;
+
+    if (s->bit != 8) return;
+
+    // only the last group of a stream can hold fewer than 8 blocks, and it is shorter than this
+    while (in_size - ip >= 1 + 16 && out_cap - op >= 8 * RLE_MAX_RUN + RLE_WIDE) {
+        uint8_t ctrl = in[ip++];
+
+        if (!ctrl) {
+            memcpy(out + op, in + ip, 8);
+            op += 8;
+            ip += 8;
+            continue;
+        }
+
+        for (int bit = 0; bit < 8; bit++) {
+            if (ctrl & (1 << bit)) {
+                uint8_t count = in[ip];
+                store_run(out + op, in[ip + 1], count);
+                op += count;
+                ip += 2;
+            } else {
+                out[op++] = in[ip++];
+            }
+        }
+    }
+
+    *in_pos = ip;
+    *out_pos = op;
+}
+
+size_t rle_stream_decompress(rle_stream* stream, uint8_t* out, size_t out_cap, const uint8_t* in, size_t in_size,
+                             size_t* in_used) {
+    size_t in_pos = 0, out_pos = 0;
+
+    for (;;) {
+        // finish a run cut off by the end of the last output buffer
+        if (stream->left) {
+            size_t n = out_cap - out_pos < stream->left ? out_cap - out_pos : stream->left;
+            memset(out + out_pos, stream->sym, n);
+            out_pos += n;
+            stream->left -= (uint8_t)n;
+            if (stream->left) break;
+        }
+
+        // finish a run block cut off by the end of the last input chunk
+        if (stream->pending) {
+            if (in_pos == in_size) break;
+            if (stream->pending == 2) {
+                stream->count = in[in_pos++];
+            } else {
+                stream->sym = in[in_pos++];
+                stream->left = stream->count;
+            }
+            stream->pending--;
+            continue;
+        }
+
+        expand_blocks(stream, out, out_cap, &out_pos, in, in_size, &in_pos);
+
+        if (stream->bit == 8) {
+            if (in_pos == in_size) break;
+            stream->ctrl = in[in_pos++];
+            stream->bit = 0;
+        }
+
+        if (in_pos == in_size) break;
+
+        if (stream->ctrl & (1 << stream->bit)) {
+            stream->pending = 2;
+        } else {
+            if (out_pos == out_cap) break;
+            out[out_pos++] = in[in_pos++];
+        }
+
+        stream->bit++;
+    }
+
+    if (in_used) *in_used = in_pos;
+    return out_pos;
+}
+
+size_t decompress_rle_ex(uint8_t* out, size_t out_cap, const uint8_t* in, size_t in_size) {
+    rle_stream stream;
+    size_t in_used;
+
+    rle_stream_init(&stream);
+    size_t out_size = rle_stream_decompress(&stream, out, out_cap, in, in_size, &in_used);
+
+    if (in_used != in_size || !rle_stream_done(&stream)) return RLE_ERROR;
+    return out_size;
+}
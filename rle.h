@@ -29,3 +29,78 @@ size_t compress_rle(uint8_t* out, const uint8_t* in, size_t in_size);
  * @return Size of the decompressed data written to the output buffer.
  */
 size_t decompress_rle(uint8_t* out, const uint8_t* in, size_t in_size);
+
+/**
+ * @brief Returned by the capacity-checked variants when the output does not fit or the input is malformed.
+ */
+#define RLE_ERROR ((size_t)-1)
+
+/**
+ * @brief Largest output compress_rle() can produce for in_size input bytes.
+ */
+size_t compress_rle_bound(size_t in_size);
+
+/**
+ * @brief Capacity-checked compress_rle().
+ * 
+ * Produces the same format, without the unused control byte compress_rle() reserves when the
+ * input ends on a group of 8 blocks.
+ * 
+ * @param out Pointer to the output buffer to store compressed data.
+ * @param out_cap Size of the output buffer in bytes.
+ * @param in Pointer to the input buffer to be compressed.
+ * @param in_size Size of the input buffer in bytes.
+ * @return Size of the compressed data, or RLE_ERROR if it does not fit into out_cap bytes.
+ */
+size_t compress_rle_ex(uint8_t* out, size_t out_cap, const uint8_t* in, size_t in_size);
+
+/**
+ * @brief Capacity-checked decompress_rle().
+ * 
+ * Runs are expanded with wide stores, which may write scratch bytes anywhere below out_cap past
+ * the returned size.
+ * 
+ * @param out Pointer to the output buffer to store decompressed data.
+ * @param out_cap Size of the output buffer in bytes.
+ * @param in Pointer to the compressed input buffer.
+ * @param in_size Size of the compressed input buffer in bytes.
+ * @return Size of the decompressed data, or RLE_ERROR if it does not fit into out_cap bytes or
+ *         the input ends inside a run.
+ */
+size_t decompress_rle_ex(uint8_t* out, size_t out_cap, const uint8_t* in, size_t in_size);
+
+/**
+ * @brief State of a streaming decompression, zero it or call rle_stream_init() before the first chunk.
+ */
+typedef struct _rle_stream {
+    uint8_t ctrl;       // control byte of the current group
+    uint8_t bit;        // next block of the group, 8 when a control byte is due
+    uint8_t pending;    // bytes of a run block still to read: 2 count and symbol, 1 symbol
+    uint8_t count;      // run length read so far
+    uint8_t sym;
+    uint8_t left;       // run bytes still to write
+} rle_stream;
+
+void rle_stream_init(rle_stream* stream);
+
+/**
+ * @brief Decompress a chunk of compressed data, resuming where the previous call stopped.
+ * 
+ * Stops when the input chunk is used up or the output buffer is full, in the middle of a block
+ * if need be. Call again with the rest of the input and/or a fresh output buffer.
+ * 
+ * @param stream Decompression state.
+ * @param out Pointer to the output buffer to store decompressed data.
+ * @param out_cap Size of the output buffer in bytes.
+ * @param in Pointer to the compressed input chunk.
+ * @param in_size Size of the compressed input chunk in bytes.
+ * @param in_used Receives the number of input bytes consumed (may be NULL).
+ * @return Size of the decompressed data written to the output buffer.
+ */
+size_t rle_stream_decompress(rle_stream* stream, uint8_t* out, size_t out_cap, const uint8_t* in, size_t in_size,
+                             size_t* in_used);
+
+/**
+ * @brief Is the stream between blocks, i.e. did the input so far end cleanly.
+ */
+int rle_stream_done(const rle_stream* stream);
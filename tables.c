@@ -318,13 +318,13 @@ static unsigned char flags_table_ex[256] =
 	/* 0F16 */    OP_MODRM,
 	/* 0F17 */    OP_MODRM,
 	/* 0F18 */    OP_MODRM,
-	/* 0F19 */    OP_INVALID,
-	/* 0F1A */    OP_INVALID,
-	/* 0F1B */    OP_INVALID,
-	/* 0F1C */    OP_INVALID,
-	/* 0F1D */    OP_INVALID,
-	/* 0F1E */    OP_INVALID,
-	/* 0F1F */    OP_NONE,
+	/* 0F19 */    OP_MODRM,
+	/* 0F1A */    OP_MODRM,
+	/* 0F1B */    OP_MODRM,
+	/* 0F1C */    OP_MODRM,
+	/* 0F1D */    OP_MODRM,
+	/* 0F1E */    OP_MODRM,
+	/* 0F1F */    OP_MODRM,
 
 	/* 0F20 */    OP_MODRM,
 	/* 0F21 */    OP_MODRM,
@@ -568,7 +568,12 @@ static unsigned char flags_table_ex[256] =
 void print_compressed_table(const char* name, unsigned char* table, size_t table_size) {
 
 	uint8_t compressed[256] = { 0 };
-	size_t len = compress_rle(compressed, table, table_size);
+	size_t len = compress_rle_ex(compressed, sizeof(compressed), table, table_size);
+
+	if (len == RLE_ERROR) {
+		fprintf(stderr, "%s does not compress into %zu bytes\n", name, sizeof(compressed));
+		return;
+	}
 
 	printf("size_t %s_len = %zu;\n", name, len);
 	printf("uint32_t %s[] = {\n", name);